@@ -0,0 +1,233 @@
+#include "AnytimeSampler.h"
+#include <cmath>
+
+// Batches needed before the variance of their means is trusted
+static const int32 MinBatches = 10;
+
+void FAnytimeSampler::init(const gum::IBayesNet<double>& bn, const std::vector<std::pair<gum::NodeId, std::vector<double>>>& evidence, bool gibbs, int32 burnIn, uint32 seed)
+{
+	gum::NodeId maxId = 0;
+	int32 maxDomain = 1;
+
+	for (gum::NodeId id : bn.nodes())
+		maxId = FMath::Max(maxId, id + 1);
+
+	Nodes.assign(maxId, FNode());
+	offsets.assign(maxId + 1, 0);
+
+	for (gum::NodeId id = 0; id < maxId; id++) {
+		offsets[id + 1] = offsets[id];
+		if (!bn.exists(id))
+			continue;
+
+		const gum::Potential<double>& cpt = bn.cpt(id);
+		FNode& node = Nodes[id];
+		gum::Instantiation inst(cpt);
+		int32 stride = (int32)cpt.variable(0).domainSize();
+
+		node.domain = stride;
+		node.cpt.reserve(cpt.domainSize());
+		for (inst.setFirst(); !inst.end(); inst.inc())
+			node.cpt.push_back(cpt.get(inst));
+
+		for (gum::Idx k = 1; k < cpt.nbrDim(); k++) {
+			const gum::NodeId parent = bn.nodeId(cpt.variable(k));
+
+			node.parents.push_back(parent);
+			node.parentStrides.push_back(stride);
+			stride *= (int32)cpt.variable(k).domainSize();
+		}
+
+		offsets[id + 1] += node.domain;
+		maxDomain = FMath::Max(maxDomain, node.domain);
+	}
+
+	for (gum::NodeId id = 0; id < maxId; id++)
+		for (gum::NodeId parent : Nodes[id].parents)
+			Nodes[parent].children.push_back(id);
+
+	for (const auto& item : evidence) {
+		FNode& node = Nodes[item.first];
+		int32 possible = 0;
+
+		node.likelihood = item.second;
+		for (double value : node.likelihood)
+			possible += value > 0;
+		node.fixed = possible == 1;
+	}
+
+	Topological.clear();
+	for (gum::NodeId id : bn.topologicalOrder())
+		Topological.push_back(id);
+
+	State.assign(maxId, 0);
+	Conditional.assign(maxDomain, 0);
+	Random.seed(seed);
+	Gibbs = gibbs;
+
+	estimates.assign(offsets.back(), 0);
+	SliceCounts.assign(offsets.back(), 0);
+	Sums.assign(offsets.back(), 0);
+	SquaredSums.assign(offsets.back(), 0);
+	CrossSums.assign(offsets.back(), 0);
+	WeightSum = 0;
+	SquaredWeightSum = 0;
+	Samples = 0;
+	Batches = 0;
+
+	if (!Gibbs)
+		return;
+
+	// The chain starts from a forward sample compatible with the evidence and is burnt in only here
+	int32 attempts = 0;
+
+	while (forwardSample() <= 0)
+		if (++attempts >= 1000)
+			GUM_ERROR(gum::IncompatibleEvidence, "no starting point of the chain is compatible with the evidence");
+
+	for (int32 i = 0; i < burnIn; i++)
+		gibbsSweep();
+}
+
+int32 FAnytimeSampler::cptIndex(gum::NodeId id) const
+{
+	const FNode& node = Nodes[id];
+	int32 index = 0;
+
+	for (size_t k = 0; k < node.parents.size(); k++)
+		index += State[node.parents[k]] * node.parentStrides[k];
+	return index;
+}
+
+int32 FAnytimeSampler::draw(const std::vector<double>& weights, double total)
+{
+	double u = std::uniform_real_distribution<double>(0, total)(Random);
+	int32 last = 0;
+
+	for (int32 x = 0; x < (int32)weights.size(); x++) {
+		if (weights[x] <= 0)
+			continue;
+		last = x;
+		u -= weights[x];
+		if (u < 0)
+			break;
+	}
+	return last;
+}
+
+double FAnytimeSampler::forwardSample()
+{
+	double weight = 1;
+
+	// Observed nodes are drawn from their CPT times the likelihood, the normaliser being the likelihood weight
+	for (gum::NodeId id : Topological) {
+		const FNode& node = Nodes[id];
+		const double* cpt = node.cpt.data() + cptIndex(id);
+		double total = 0;
+
+		Conditional.resize(node.domain);
+		for (int32 x = 0; x < node.domain; x++) {
+			Conditional[x] = cpt[x] * (node.likelihood.empty() ? 1 : node.likelihood[x]);
+			total += Conditional[x];
+		}
+		if (total <= 0)
+			return 0;
+
+		State[id] = draw(Conditional, total);
+		if (!node.likelihood.empty())
+			weight *= total;
+	}
+	return weight;
+}
+
+void FAnytimeSampler::gibbsSweep()
+{
+	for (gum::NodeId id : Topological) {
+		const FNode& node = Nodes[id];
+
+		if (node.fixed)
+			continue;
+
+		const double* cpt = node.cpt.data() + cptIndex(id);
+		const int32 current = State[id];
+		double total = 0;
+
+		// Markov blanket: own CPT, likelihood and the CPT entry of every child
+		Conditional.resize(node.domain);
+		for (int32 x = 0; x < node.domain; x++) {
+			double p = cpt[x] * (node.likelihood.empty() ? 1 : node.likelihood[x]);
+
+			State[id] = x;
+			for (gum::NodeId child : node.children)
+				p *= Nodes[child].cpt[cptIndex(child) + State[child]];
+			Conditional[x] = p;
+			total += p;
+		}
+
+		State[id] = total > 0 ? draw(Conditional, total) : current;
+	}
+}
+
+int64 FAnytimeSampler::runSlice(int64 maxSamples, double maxSeconds)
+{
+	const double start = FPlatformTime::Seconds();
+	double batchWeight = 0;
+	int64 drawn = 0;
+
+	std::fill(SliceCounts.begin(), SliceCounts.end(), 0.0);
+
+	while (drawn < maxSamples) {
+		double weight = 1;
+
+		if (Gibbs)
+			gibbsSweep();
+		else
+			weight = forwardSample();
+
+		if (weight > 0) {
+			for (gum::NodeId id : Topological)
+				SliceCounts[offsets[id] + State[id]] += weight;
+			batchWeight += weight;
+		}
+
+		// The clock is read every few samples only
+		if ((++drawn & 63) == 0 && FPlatformTime::Seconds() - start >= maxSeconds)
+			break;
+	}
+
+	for (size_t j = 0; j < SliceCounts.size(); j++) {
+		Sums[j] += SliceCounts[j];
+		SquaredSums[j] += SliceCounts[j] * SliceCounts[j];
+		CrossSums[j] += SliceCounts[j] * batchWeight;
+	}
+	WeightSum += batchWeight;
+	SquaredWeightSum += batchWeight * batchWeight;
+	Samples += drawn;
+	Batches++;
+
+	if (WeightSum <= 0)
+		GUM_ERROR(gum::IncompatibleEvidence, "no sample is compatible with the evidence");
+
+	for (size_t j = 0; j < estimates.size(); j++)
+		estimates[j] = Sums[j] / WeightSum;
+	return drawn;
+}
+
+double FAnytimeSampler::errorBound() const
+{
+	if (Batches < MinBatches || WeightSum <= 0)
+		return 1;
+
+	// Variance of the ratio estimate sum(S_b) / sum(W_b) from the spread of the batches: sum((S_b - p W_b)^2)
+	double worst = 0;
+
+	for (size_t j = 0; j < estimates.size(); j++) {
+		const double p = estimates[j];
+
+		worst = FMath::Max(worst, SquaredSums[j] - 2 * p * CrossSums[j] + p * p * SquaredWeightSum);
+	}
+
+	const double variance = worst * Batches / ((Batches - 1) * WeightSum * WeightSum);
+
+	return FMath::Min(1.0, 1.96 * std::sqrt(FMath::Max(variance, 0.0)));
+}
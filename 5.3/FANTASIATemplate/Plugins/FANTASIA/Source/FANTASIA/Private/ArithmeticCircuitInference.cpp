@@ -0,0 +1,405 @@
+#include "ArithmeticCircuitInference.h"
+#include "agrum/tools/graphs/algorithms/triangulations/defaultTriangulation.h"
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+	// Table of circuit nodes over some variables, first variable varying fastest
+	struct FCircuitFactor
+	{
+		std::vector<gum::NodeId> vars;
+		std::vector<int32> entries;
+	};
+
+	// Constant leaves added first by compile
+	constexpr int32 Zero = 0;
+	constexpr int32 One = 1;
+}
+
+// childStart always holds one more entry than ops, the end of the children of the last node
+int32 FArithmeticCircuit::addLeaf(double value)
+{
+	if (value == 0 && ops.size() > Zero)
+		return Zero;
+	if (value == 1 && ops.size() > One)
+		return One;
+
+	ops.push_back(Leaf);
+	values.push_back(value);
+	childStart.push_back(children.size());
+	return (int32)ops.size() - 1;
+}
+
+int32 FArithmeticCircuit::addNode(uint8 op, const std::vector<int32>& nodes)
+{
+	children.insert(children.end(), nodes.begin(), nodes.end());
+	ops.push_back(op);
+	values.push_back(0);
+	childStart.push_back(children.size());
+	return (int32)ops.size() - 1;
+}
+
+int32 FArithmeticCircuit::addSum(std::vector<int32>& nodes)
+{
+	nodes.erase(std::remove(nodes.begin(), nodes.end(), Zero), nodes.end());
+
+	if (nodes.empty())
+		return Zero;
+	if (nodes.size() == 1)
+		return nodes[0];
+	return addNode(Sum, nodes);
+}
+
+int32 FArithmeticCircuit::addProduct(std::vector<int32>& nodes)
+{
+	if (std::find(nodes.begin(), nodes.end(), Zero) != nodes.end())
+		return Zero;
+
+	nodes.erase(std::remove(nodes.begin(), nodes.end(), One), nodes.end());
+
+	if (nodes.empty())
+		return One;
+	if (nodes.size() == 1)
+		return nodes[0];
+	return addNode(Product, nodes);
+}
+
+void FArithmeticCircuit::compile(const gum::IBayesNet<double>& bn, const std::vector<gum::NodeId>* order)
+{
+	std::vector<FCircuitFactor> factors;
+	std::vector<gum::NodeId> elimination;
+	std::vector<int32> nodes;
+	gum::NodeId maxId = 0;
+
+	ops.clear();
+	childStart.assign(1, 0);
+	children.clear();
+	values.clear();
+
+	for (gum::NodeId id : bn.nodes())
+		maxId = FMath::Max(maxId, id + 1);
+
+	// Leaves first: the constants, one indicator per state and the parameters. Zero and one parameters map
+	// to the constants, which lets deterministic CPTs prune whole subcircuits
+	addLeaf(0);
+	addLeaf(1);
+
+	indicators.assign(maxId, -1);
+	for (gum::NodeId id : bn.nodes()) {
+		indicators[id] = (int32)ops.size();
+		for (gum::Idx j = 0; j < bn.variable(id).domainSize(); j++) {
+			ops.push_back(Leaf);
+			values.push_back(1);
+			childStart.push_back(children.size());
+		}
+	}
+
+	for (gum::NodeId id : bn.nodes()) {
+		const gum::Potential<double>& cpt = bn.cpt(id);
+		FCircuitFactor& factor = factors.emplace_back();
+		gum::Instantiation inst(cpt);
+
+		for (gum::Idx k = 0; k < cpt.nbrDim(); k++)
+			factor.vars.push_back(bn.nodeId(cpt.variable(k)));
+
+		factor.entries.reserve(cpt.domainSize());
+		for (inst.setFirst(); !inst.end(); inst.inc())
+			factor.entries.push_back(addLeaf(cpt.get(inst)));
+	}
+
+	firstInternal = (int32)ops.size();
+
+	// Each indicator is multiplied into the CPT of its own variable
+	{
+		size_t f = 0;
+
+		for (gum::NodeId id : bn.nodes()) {
+			FCircuitFactor& factor = factors[f++];
+			const gum::Potential<double>& cpt = bn.cpt(id);
+			gum::Instantiation inst(cpt);
+			size_t j = 0;
+
+			for (inst.setFirst(); !inst.end(); inst.inc(), ++j) {
+				nodes.assign({ factor.entries[j], indicators[id] + (int32)inst.val(bn.variable(id)) });
+				factor.entries[j] = addProduct(nodes);
+			}
+		}
+	}
+
+	if (order && order->size() == bn.size())
+		elimination = *order;
+	else {
+		gum::UndiGraph moralGraph = bn.moralGraph();
+		gum::NodeProperty<gum::Size> domainSizes;
+
+		for (gum::NodeId id : bn.nodes())
+			domainSizes.insert(id, bn.variable(id).domainSize());
+
+		gum::DefaultTriangulation triangulation(&moralGraph, &domainSizes);
+
+		elimination = triangulation.eliminationOrder();
+	}
+
+	std::vector<bool> alive(factors.size(), true);
+	std::vector<int32> bucket;
+	std::vector<int32> terms;
+
+	for (gum::NodeId var : elimination) {
+		bucket.clear();
+		for (size_t f = 0; f < factors.size(); f++) {
+			if (alive[f] && std::find(factors[f].vars.begin(), factors[f].vars.end(), var) != factors[f].vars.end()) {
+				bucket.push_back((int32)f);
+				alive[f] = false;
+			}
+		}
+		if (bucket.empty())
+			continue;
+
+		// The eliminated variable comes first so that each sum reads consecutive configurations
+		std::vector<gum::NodeId> scope{ var };
+		std::vector<int64> dims;
+		std::vector<std::vector<int64>> strides(bucket.size());
+
+		for (int32 f : bucket)
+			for (gum::NodeId v : factors[f].vars)
+				if (std::find(scope.begin(), scope.end(), v) == scope.end())
+					scope.push_back(v);
+
+		for (gum::NodeId v : scope)
+			dims.push_back(bn.variable(v).domainSize());
+
+		for (size_t b = 0; b < bucket.size(); b++) {
+			const std::vector<gum::NodeId>& vars = factors[bucket[b]].vars;
+
+			int64 stride = 1;
+
+			strides[b].assign(scope.size(), 0);
+			for (gum::NodeId v : vars) {
+				strides[b][std::find(scope.begin(), scope.end(), v) - scope.begin()] = stride;
+				stride *= bn.variable(v).domainSize();
+			}
+		}
+
+		FCircuitFactor result;
+		std::vector<int64> digits(scope.size(), 0);
+		int64 total = 1;
+
+		for (int64 dim : dims)
+			total *= dim;
+
+		result.vars.assign(scope.begin() + 1, scope.end());
+		result.entries.reserve(total / dims[0]);
+
+		for (int64 index = 0; index < total; index += dims[0]) {
+			terms.clear();
+			for (digits[0] = 0; digits[0] < dims[0]; digits[0]++) {
+				nodes.clear();
+				for (size_t b = 0; b < bucket.size(); b++) {
+					int64 offset = 0;
+
+					for (size_t k = 0; k < scope.size(); k++)
+						offset += digits[k] * strides[b][k];
+					nodes.push_back(factors[bucket[b]].entries[offset]);
+				}
+				terms.push_back(addProduct(nodes));
+			}
+			result.entries.push_back(addSum(terms));
+
+			for (size_t k = 1; k < scope.size(); k++) {
+				if (++digits[k] < dims[k])
+					break;
+				digits[k] = 0;
+			}
+		}
+
+		factors.push_back(MoveTemp(result));
+		alive.push_back(true);
+	}
+
+	// Everything is eliminated, the remaining factors are scalars
+	nodes.clear();
+	for (size_t f = 0; f < factors.size(); f++)
+		if (alive[f])
+			nodes.push_back(factors[f].entries[0]);
+	root = addProduct(nodes);
+
+	int32 widest = 0;
+
+	for (size_t i = 0; i + 1 < childStart.size(); i++)
+		widest = FMath::Max(widest, childStart[i + 1] - childStart[i]);
+
+	scratch.assign(widest, 0);
+	derivatives.assign(ops.size(), 0);
+}
+
+double FArithmeticCircuit::evaluate()
+{
+	const int32 n = (int32)ops.size();
+	const uint8* op = ops.data();
+	const int32* start = childStart.data();
+	const int32* kids = children.data();
+	double* value = values.data();
+
+	for (int32 i = firstInternal; i < n; i++) {
+		const int32* c = kids + start[i];
+		const int32 count = start[i + 1] - start[i];
+		double r;
+
+		if (op[i] == Sum) {
+			r = 0;
+			for (int32 k = 0; k < count; k++)
+				r += value[c[k]];
+		}
+		else {
+			r = 1;
+			for (int32 k = 0; k < count; k++)
+				r *= value[c[k]];
+		}
+		value[i] = r;
+	}
+	return value[root];
+}
+
+void FArithmeticCircuit::differentiate()
+{
+	const uint8* op = ops.data();
+	const int32* start = childStart.data();
+	const int32* kids = children.data();
+	const double* value = values.data();
+	double* derivative = derivatives.data();
+	double* others = scratch.data();
+
+	std::fill(derivatives.begin(), derivatives.end(), 0.0);
+	derivative[root] = 1;
+
+	for (int32 i = (int32)ops.size() - 1; i >= firstInternal; i--) {
+		const double d = derivative[i];
+
+		if (d == 0)
+			continue;
+
+		const int32* c = kids + start[i];
+		const int32 count = start[i + 1] - start[i];
+
+		if (op[i] == Sum) {
+			for (int32 k = 0; k < count; k++)
+				derivative[c[k]] += d;
+			continue;
+		}
+
+		// Product of the other children from prefix and suffix products, no division so zeros are handled
+		double prefix = 1;
+
+		for (int32 k = 0; k < count; k++) {
+			others[k] = prefix;
+			prefix *= value[c[k]];
+		}
+
+		double suffix = d;
+
+		for (int32 k = count - 1; k >= 0; k--) {
+			derivative[c[k]] += others[k] * suffix;
+			suffix *= value[c[k]];
+		}
+	}
+}
+
+FArithmeticCircuitInference::FArithmeticCircuitInference(const gum::IBayesNet<double>* bn, const std::vector<gum::NodeId>* order)
+: gum::MarginalTargetedInference<double>(bn)
+{
+	if (order)
+		Order = *order;
+}
+
+void FArithmeticCircuitInference::onModelChanged_(const gum::GraphicalModel* bn)
+{
+	gum::MarginalTargetedInference<double>::onModelChanged_(bn);
+	Compiled = false;
+}
+
+void FArithmeticCircuitInference::updateOutdatedStructure_()
+{
+	if (Compiled)
+		return;
+
+	const gum::IBayesNet<double>& bn = this->BN();
+
+	Circuit.compile(bn, Order.empty() ? nullptr : &Order);
+
+	Posteriors.clear();
+	Posteriors.resize(Circuit.indicators.size());
+	for (gum::NodeId id : bn.nodes()) {
+		Posteriors[id] = std::make_unique<gum::Potential<double>>();
+		Posteriors[id]->add(bn.variable(id));
+	}
+	Compiled = true;
+}
+
+void FArithmeticCircuitInference::makeInference_()
+{
+	const gum::IBayesNet<double>& bn = this->BN();
+	const auto& evidence = this->evidence();
+	std::vector<double> values;
+	double logScale = 0;
+
+	// Likelihoods are divided by their largest entry so that small ones do not drive the root to zero, their
+	// scales go to logScale
+	for (gum::NodeId id : bn.nodes()) {
+		double* indicator = Circuit.values.data() + Circuit.indicators[id];
+		const gum::Size size = bn.variable(id).domainSize();
+
+		if (!evidence.exists(id)) {
+			std::fill(indicator, indicator + size, 1.0);
+			continue;
+		}
+
+		const gum::Potential<double>& likelihood = *evidence[id];
+		gum::Instantiation inst(likelihood);
+		gum::Idx j = 0;
+		double largest = 0;
+
+		for (inst.setFirst(); !inst.end(); inst.inc(), ++j) {
+			indicator[j] = likelihood.get(inst);
+			largest = FMath::Max(largest, indicator[j]);
+		}
+
+		if (largest <= 0)
+			GUM_ERROR(gum::IncompatibleEvidence, "the evidence has a null probability");
+
+		for (j = 0; j < size; j++)
+			indicator[j] /= largest;
+		logScale += std::log(largest);
+	}
+
+	const double root = Circuit.evaluate();
+	if (root <= 0)
+		GUM_ERROR(gum::IncompatibleEvidence, "the evidence has a null probability");
+
+	EvidenceProbability = root * std::exp(logScale);
+
+	Circuit.differentiate();
+
+	// The circuit is multilinear in the indicators of each variable, so these terms sum to the root
+	for (gum::NodeId id : bn.nodes()) {
+		const int32 first = Circuit.indicators[id];
+		const gum::Size size = bn.variable(id).domainSize();
+
+		values.resize(size);
+		for (gum::Idx j = 0; j < size; j++)
+			values[j] = Circuit.values[first + j] * Circuit.derivatives[first + j] / root;
+
+		Posteriors[id]->fillWith(values);
+	}
+}
+
+const gum::Potential<double>& FArithmeticCircuitInference::posterior_(gum::NodeId id)
+{
+	return *Posteriors[id];
+}
+
+double FArithmeticCircuitInference::evidenceProbability()
+{
+	this->makeInference();
+	return EvidenceProbability;
+}
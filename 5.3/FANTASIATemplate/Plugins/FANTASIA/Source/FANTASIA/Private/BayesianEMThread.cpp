@@ -0,0 +1,450 @@
+#include "BayesianEMThread.h"
+#include "HAL/PlatformFileManager.h"
+#include "GenericPlatform/GenericPlatformFile.h"
+#include "Async/ParallelFor.h"
+#include <algorithm>
+#include <cmath>
+
+// Rows a worker takes at once, long enough for runs of rows with the same missing cells
+static const int32 RowsPerTask = 64;
+
+namespace
+{
+	// Reads a file line by line through a buffer holding one block and the partial line before it
+	class FLogLineReader
+	{
+	public:
+
+		bool Open(const FString& Filename)
+		{
+			Handle.Reset(FPlatformFileManager::Get().GetPlatformFile().OpenRead(*Filename));
+			Buffer.Reset();
+			Start = Scan = 0;
+			return Handle.IsValid();
+		}
+
+		bool ReadLine(FString& Line)
+		{
+			for (;;) {
+				for (; Scan < Buffer.Num(); Scan++) {
+					if (Buffer[Scan] == '\n') {
+						Assign(Line, Scan);
+						Start = ++Scan;
+						return true;
+					}
+				}
+
+				const int64 Remaining = Handle->Size() - Handle->Tell();
+
+				if (Remaining <= 0) {
+					if (Start == Buffer.Num())
+						return false;
+					Assign(Line, Buffer.Num());
+					Start = Scan = Buffer.Num();
+					return true;
+				}
+
+				Buffer.RemoveAt(0, Start, false);
+				Scan -= Start;
+				Start = 0;
+
+				const int32 Size = (int32)FMath::Min<int64>(Remaining, BlockSize);
+				const int32 Offset = Buffer.AddUninitialized(Size);
+
+				if (!Handle->Read(Buffer.GetData() + Offset, Size)) {
+					Buffer.SetNum(Offset, false);
+					return false;
+				}
+			}
+		}
+
+	private:
+
+		static constexpr int32 BlockSize = 1 << 16;
+
+		TUniquePtr<IFileHandle> Handle;
+		TArray<uint8> Buffer;
+		int32 Start = 0;
+		int32 Scan = 0;
+
+		void Assign(FString& Line, int32 End) const
+		{
+			if (End > Start && Buffer[End - 1] == '\r')
+				End--;
+
+			FUTF8ToTCHAR Converter((const ANSICHAR*)Buffer.GetData() + Start, End - Start);
+			Line = FString(Converter.Length(), Converter.Get());
+		}
+	};
+}
+
+FBayesianEMThread::FBayesianEMThread(const gum::BayesNet<double>& network, const FBayesianEMSettings& settings, TFunction<void(int32, double)> onIteration, TFunction<void(bool, double)> onFinished)
+: StopTaskCounter(0), Network(network), Settings(settings), OnIteration(MoveTemp(onIteration)), OnFinished(MoveTemp(onFinished))
+{
+	gum::NodeId maxId = 0;
+
+	for (gum::NodeId id : Network.nodes())
+		maxId = FMath::Max(maxId, id + 1);
+
+	Layout.resize(maxId);
+	Families.resize(maxId);
+
+	// Same layout as the online learner, the parameters start from the current CPTs
+	for (gum::NodeId id : Network.nodes()) {
+		const gum::Potential<double>& cpt = Network.cpt(id);
+		FBNLearningNode& node = Layout[id];
+		gum::Instantiation inst(cpt);
+		int32 stride = 1;
+
+		node.offset = ParameterCount;
+		for (gum::Idx k = 0; k < cpt.nbrDim(); k++) {
+			node.vars.push_back(Network.nodeId(cpt.variable(k)));
+			node.strides.push_back(stride);
+			Families[id].insert(node.vars.back());
+			stride *= cpt.variable(k).domainSize();
+		}
+		ParameterCount += stride;
+
+		for (inst.setFirst(); !inst.end(); inst.inc())
+			Parameters.push_back(cpt.get(inst));
+	}
+
+	Thread = FRunnableThread::Create(this, TEXT("BayesianEMThread"), 0, TPri_BelowNormal);
+}
+
+FBayesianEMThread::~FBayesianEMThread()
+{
+	delete Thread;
+	Thread = nullptr;
+}
+
+uint32 FBayesianEMThread::Run()
+{
+	FString error;
+	const bool success = RunEM(error);
+
+	if (!success && StopTaskCounter.GetValue() == 0)
+		UE_LOG(LogTemp, Warning, TEXT("EM learning on %s failed: %s"), *Settings.Filename, *error);
+
+	Workers.clear();
+	OnFinished(success, LogLikelihood);
+	Running = false;
+	return 0;
+}
+
+void FBayesianEMThread::Stop()
+{
+	StopTaskCounter.Increment();
+}
+
+void FBayesianEMThread::EnsureCompletion()
+{
+	Stop();
+	if (Thread)
+		Thread->WaitForCompletion();
+}
+
+bool FBayesianEMThread::RunEM(FString& Error)
+{
+	double previous = 0;
+
+	if (!ReadHeader(Error))
+		return false;
+
+	Workers.clear();
+	for (int32 w = 0; w < FMath::Max(Settings.Threads, 1); w++) {
+		Workers.push_back(std::make_unique<FWorker>());
+		Workers.back()->bn = Network;
+	}
+
+	try {
+		for (int32 iteration = 1; iteration <= FMath::Max(Settings.MaxIterations, 1); iteration++) {
+			for (auto& worker : Workers) {
+				for (gum::NodeId id : worker->bn.nodes()) {
+					const FBNLearningNode& node = Layout[id];
+					const int32 size = worker->bn.cpt(id).domainSize();
+
+					worker->bn.cpt(id).fillWith(std::vector<double>(Parameters.begin() + node.offset, Parameters.begin() + node.offset + size));
+				}
+
+				// Every family already lies in a clique, so the joint targets do not change the junction tree
+				worker->engine = std::make_unique<gum::LazyPropagation<double>>(&worker->bn);
+				worker->engine->setNumberOfThreads(1);
+				for (gum::NodeId id : worker->bn.nodes())
+					if (Families[id].size() > 1)
+						worker->engine->addJointTarget(Families[id]);
+
+				worker->counts.assign(ParameterCount, 0);
+				worker->logLikelihood = 0;
+				worker->rejected = 0;
+			}
+
+			if (!PassOverLog(Error))
+				return false;
+
+			std::vector<double> counts(ParameterCount, 0);
+			int64 rejected = 0;
+
+			LogLikelihood = 0;
+			for (auto& worker : Workers) {
+				for (int32 j = 0; j < ParameterCount; j++)
+					counts[j] += worker->counts[j];
+				LogLikelihood += worker->logLikelihood;
+				rejected += worker->rejected;
+			}
+
+			if (rejected > 0)
+				UE_LOG(LogTemp, Log, TEXT("EM iteration %d skipped %lld rows that are impossible under the current parameters"), iteration, rejected);
+
+			Maximise(counts);
+			OnIteration(iteration, LogLikelihood);
+
+			if (iteration > 1 && FMath::Abs(LogLikelihood - previous) <= Settings.Epsilon * FMath::Abs(previous))
+				break;
+			previous = LogLikelihood;
+		}
+	}
+	catch (gum::Exception& e) {
+		Error = FString::Printf(TEXT("%hs from %hs"), e.errorType().c_str(), e.errorContent().c_str());
+		return false;
+	}
+	return true;
+}
+
+bool FBayesianEMThread::ReadHeader(FString& Error)
+{
+	FLogLineReader reader;
+	FString line;
+	TArray<FString> cells;
+	int32 mapped = 0;
+
+	if (!reader.Open(Settings.Filename) || !reader.ReadLine(line)) {
+		Error = TEXT("cannot read the header");
+		return false;
+	}
+
+	if (line.Len() > 0 && line[0] == 0xFEFF)
+		line.RightChopInline(1);
+
+	line.ParseIntoArray(cells, TEXT(","), false);
+	ColumnNodes.Init(-1, cells.Num());
+	ColumnLabels.SetNum(cells.Num());
+
+	for (int32 c = 0; c < cells.Num(); c++) {
+		const FString name = cells[c].TrimStartAndEnd().TrimQuotes();
+
+		try {
+			const gum::NodeId id = Network.idFromName(TCHAR_TO_UTF8(*name));
+			const gum::DiscreteVariable& variable = Network.variable(id);
+
+			ColumnNodes[c] = id;
+			for (gum::Idx j = 0; j < variable.domainSize(); j++)
+				ColumnLabels[c].Add(FString(variable.label(j).c_str()), j);
+			mapped++;
+		}
+		catch (gum::NotFound&) {
+		}
+	}
+
+	if (mapped == 0) {
+		Error = TEXT("no column matches a variable of the network");
+		return false;
+	}
+	return true;
+}
+
+bool FBayesianEMThread::PassOverLog(FString& Error)
+{
+	FLogLineReader reader;
+	FString line;
+	const int32 nodes = Layout.size();
+	const int32 chunkRows = FMath::Max(Settings.ChunkRows, 1);
+	std::vector<int32> chunk((size_t)chunkRows * nodes);
+
+	if (!reader.Open(Settings.Filename) || !reader.ReadLine(line)) {
+		Error = TEXT("cannot read the log");
+		return false;
+	}
+
+	while (StopTaskCounter.GetValue() == 0) {
+		int32 rows = 0;
+
+		while (rows < chunkRows && reader.ReadLine(line)) {
+			if (line.IsEmpty())
+				continue;
+			ParseRow(line, &chunk[(size_t)rows * nodes]);
+			rows++;
+		}
+
+		if (rows == 0)
+			return true;
+
+		// Rows with the same missing cells go to the same worker one after the other, its engine then only
+		// changes the values of its hard evidence and keeps the junction tree
+		std::vector<uint32> patterns(rows);
+		std::vector<int32> order(rows);
+		std::vector<uint8> missing(nodes);
+		std::atomic<int32> next(0);
+
+		for (int32 row = 0; row < rows; row++) {
+			for (int32 id = 0; id < nodes; id++)
+				missing[id] = chunk[(size_t)row * nodes + id] < 0;
+			patterns[row] = FCrc::MemCrc32(missing.data(), nodes);
+			order[row] = row;
+		}
+		std::stable_sort(order.begin(), order.end(), [&](int32 a, int32 b) { return patterns[a] < patterns[b]; });
+
+		ParallelFor((int32)Workers.size(), [&](int32 w) {
+			for (int32 first = next.fetch_add(RowsPerTask); first < rows; first = next.fetch_add(RowsPerTask))
+				for (int32 k = first; k < FMath::Min(first + RowsPerTask, rows); k++)
+					ProcessRow(*Workers[w], &chunk[(size_t)order[k] * nodes]);
+		});
+	}
+	return false;
+}
+
+void FBayesianEMThread::ParseRow(const FString& Line, int32* States) const
+{
+	TArray<FString> cells;
+
+	std::fill(States, States + Layout.size(), -1);
+	Line.ParseIntoArray(cells, TEXT(","), false);
+
+	for (int32 c = 0; c < FMath::Min(cells.Num(), ColumnNodes.Num()); c++) {
+		if (ColumnNodes[c] < 0)
+			continue;
+
+		const FString cell = cells[c].TrimStartAndEnd().TrimQuotes();
+
+		// Unknown labels count as missing too
+		if (!Settings.MissingSymbols.Contains(cell))
+			if (const int32* state = ColumnLabels[c].Find(cell))
+				States[ColumnNodes[c]] = *state;
+	}
+}
+
+void FBayesianEMThread::ProcessRow(FWorker& Worker, const int32* States) const
+{
+	bool complete = true;
+
+	for (gum::NodeId id = 0; id < Layout.size() && complete; id++)
+		complete = Layout[id].vars.empty() || States[id] >= 0;
+
+	// Complete rows are counted directly
+	if (complete) {
+		double logLikelihood = 0;
+
+		for (const FBNLearningNode& node : Layout) {
+			int32 index = node.offset;
+
+			if (node.vars.empty())
+				continue;
+			for (size_t k = 0; k < node.vars.size(); k++)
+				index += States[node.vars[k]] * node.strides[k];
+
+			if (Parameters[index] <= 0) {
+				Worker.rejected++;
+				return;
+			}
+			logLikelihood += std::log(Parameters[index]);
+		}
+
+		for (const FBNLearningNode& node : Layout) {
+			int32 index = node.offset;
+
+			if (node.vars.empty())
+				continue;
+			for (size_t k = 0; k < node.vars.size(); k++)
+				index += States[node.vars[k]] * node.strides[k];
+			Worker.counts[index] += 1;
+		}
+		Worker.logLikelihood += logLikelihood;
+		return;
+	}
+
+	gum::LazyPropagation<double>& engine = *Worker.engine;
+
+	try {
+		// The evidence of the previous row is edited in place: hard evidence shapes the junction tree of Lazy
+		// Propagation, so a new value only refreshes potentials while a cell turning observed or missing
+		// rebuilds the tree
+		for (gum::NodeId id = 0; id < Layout.size(); id++) {
+			if (States[id] < 0) {
+				if (engine.hasEvidence(id))
+					engine.eraseEvidence(id);
+			}
+			else if (!engine.hasEvidence(id))
+				engine.addEvidence(id, (gum::Idx)States[id]);
+			else if (engine.hardEvidence()[id] != (gum::Idx)States[id])
+				engine.chgEvidence(id, (gum::Idx)States[id]);
+		}
+
+		engine.makeInference();
+
+		const double probability = engine.evidenceProbability();
+
+		if (probability <= 0) {
+			Worker.rejected++;
+			return;
+		}
+		Worker.logLikelihood += std::log(probability);
+
+		// Expected counts: families that are fully observed add one, the others their joint posterior
+		for (gum::NodeId id = 0; id < Layout.size(); id++) {
+			const FBNLearningNode& node = Layout[id];
+			int32 index = node.offset;
+			size_t k;
+
+			if (node.vars.empty())
+				continue;
+
+			for (k = 0; k < node.vars.size() && States[node.vars[k]] >= 0; k++)
+				index += States[node.vars[k]] * node.strides[k];
+
+			if (k == node.vars.size()) {
+				Worker.counts[index] += 1;
+				continue;
+			}
+
+			const gum::Potential<double>& posterior = node.vars.size() > 1 ? engine.jointPosterior(Families[id]) : engine.posterior(id);
+			gum::Instantiation inst(Worker.bn.cpt(id));
+			int32 j = node.offset;
+
+			for (inst.setFirst(); !inst.end(); inst.inc(), ++j)
+				Worker.counts[j] += posterior.get(inst);
+		}
+	}
+	catch (gum::Exception&) {
+		Worker.rejected++;
+	}
+}
+
+void FBayesianEMThread::Maximise(const std::vector<double>& Counts)
+{
+	const double prior = FMath::Max(Settings.PriorWeight, 0.0);
+
+	for (gum::NodeId id = 0; id < Layout.size(); id++) {
+		const FBNLearningNode& node = Layout[id];
+
+		// aGrUM puts the node itself first in its CPT, parents follow
+		if (node.vars.empty() || node.vars[0] != id)
+			continue;
+
+		const int32 childSize = Network.variable(id).domainSize();
+		const int32 size = Network.cpt(id).domainSize();
+
+		for (int32 config = node.offset; config < node.offset + size; config += childSize) {
+			double n = 0;
+
+			for (int32 c = 0; c < childSize; c++)
+				n += Counts[config + c];
+
+			// Parent configurations never seen keep their current distribution
+			if (n <= 0)
+				continue;
+
+			for (int32 c = 0; c < childSize; c++)
+				Parameters[config + c] = (Counts[config + c] + prior) / (n + prior * childSize);
+		}
+	}
+}
@@ -1,7 +1,25 @@
 // Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
 
 #include "BayesianNetwork.h"
+#include "BayesianNetworkSession.h"
+#include "BayesianEMThread.h"
+#include "ArithmeticCircuitInference.h"
+#include "JunctionTreeInference.h"
+#include "MaxProductElimination.h"
+#include "InferenceThreadBudget.h"
+#include "Serialization/MemoryWriter.h"
+#include "Serialization/MemoryReader.h"
+#include "Async/ParallelFor.h"
+#include "agrum/BN/io/UAI/UAIBNReader.h"
+#include "agrum/BN/io/net/netReader.h"
+#include "agrum/BN/io/DSL/DSLReader.h"
+#include "agrum/BN/io/XDSL/XDSLBNReader.h"
+#include "agrum/BN/io/BIFXML/BIFXMLBNReader.h"
 #include <vector>
+#include <sstream>
+
+// Layout version of cookedNetwork
+static const int32 CookedNetworkMagic = 0x46424E31;
 
 
 std::vector<float> myLinspace(float start, float end, int points)
@@ -24,232 +42,2864 @@ std::vector<float> myLinspace(float start, float end, int points)
 
 }
 
+static void potentialToVector(const gum::Potential<double>& pot, std::vector<double>& out)
+{
+	gum::Instantiation inst(pot);
+
+	out.clear();
+	for (inst.setFirst(); !inst.end(); inst.inc())
+		out.push_back(pot.get(inst));
+}
+
 UBayesianNetwork::UBayesianNetwork(const FObjectInitializer& ObjectInitializer)
 : Super(ObjectInitializer)
-{}
+{
+	inference = createInference(&bn, &inferenceScheduler, &inferenceApproximation);
+}
 
-void UBayesianNetwork::Init() {
-	if (!initialized) {	
-		initialized = true;
+void UBayesianNetwork::BeginDestroy()
+{
+	Super::BeginDestroy();
+	stopAnytimeInference();
+	if (emThread)
+		emThread->Stop();
+	asyncCallbacks.Empty();
+	queuedCallbacks.Empty();
+}
+
+bool UBayesianNetwork::IsReadyForFinishDestroy()
+{
+	// The worker still references asyncBN and the pending buffer
+	return !asyncWorking && !(emThread && emThread->IsRunning()) && Super::IsReadyForFinishDestroy();
+}
+
+void UBayesianNetwork::FinishDestroy()
+{
+	if (emThread) {
+		emThread->EnsureCompletion();
+		delete emThread;
+		emThread = nullptr;
+		FInferenceThreadBudget::Release(emThreads);
 	}
+	batchWorkers.clear();
+	delete asyncInference;
+	asyncInference = nullptr;
+	delete inference;
+	inference = nullptr;
+	Super::FinishDestroy();
+}
+
+template <typename Engine>
+static Engine* configureEngine(Engine* engine, const gum::OrderedTriangulation* triangulation, BNRelevantPotentials relevantPotentials, bool findBarrenNodes, gum::ScheduledInference** scheduler, gum::ApproximationScheme** approximation)
+{
+	if (triangulation)
+		engine->setTriangulation(*triangulation);
+
+	// BNRelevantPotentials mirrors the order of gum::RelevantPotentialsFinderType
+	engine->setRelevantPotentialsFinderType((gum::RelevantPotentialsFinderType)relevantPotentials);
+	engine->setFindBarrenNodesType(findBarrenNodes ? gum::FindBarrenNodesType::FIND_BARREN_NODES : gum::FindBarrenNodesType::FIND_NO_BARREN_NODES);
+
+	// Propagations triggered lazily stay single threaded, queries on the main engine go through ensureInference instead
+	engine->setNumberOfThreads(1);
+	if (scheduler)
+		*scheduler = engine;
+	if (approximation)
+		*approximation = nullptr;
+	return engine;
+}
+
+template <typename Engine>
+static Engine* configureApproximateEngine(Engine* engine, gum::ScheduledInference** scheduler, gum::ApproximationScheme** approximation)
+{
+	// Keeps the epsilon of every period so that the last one can be reported
+	engine->setVerbosity(true);
+	if (scheduler)
+		*scheduler = nullptr;
+	if (approximation)
+		*approximation = engine;
+	return engine;
+}
+
+gum::MarginalTargetedInference<double>* UBayesianNetwork::createInference(const gum::BayesNet<double>* net, gum::ScheduledInference** scheduler, gum::ApproximationScheme** approximation, InferenceAlgs algorithm) const
+{
+	// The persisted elimination order replaces the triangulation heuristic when it matches the structure
+	const gum::OrderedTriangulation* triangulation = compiledOrder.empty() ? nullptr : &compiledTriangulation;
 
-	switch (InferenceAlgorithm)
+	switch (algorithm)
 	{
 	case InferenceAlgs::Lazy_Propagation:
-		inference = new gum::LazyPropagation<double>(&bn); break;
-	case InferenceAlgs::ShaferShenoy:
-		inference = new gum::ShaferShenoyInference<double>(&bn); break;
+		return configureEngine(new gum::LazyPropagation<double>(net), triangulation, RelevantPotentials, FindBarrenNodes, scheduler, approximation);
 	case InferenceAlgs::VariableElimination:
-		inference = new gum::VariableElimination<double>(&bn); break;
+		return configureEngine(new gum::VariableElimination<double>(net), triangulation, RelevantPotentials, FindBarrenNodes, scheduler, approximation);
+	case InferenceAlgs::GibbsSampling:
+		return configureApproximateEngine(new gum::GibbsSampling<double>(net), scheduler, approximation);
+	case InferenceAlgs::LoopyBeliefPropagation:
+		return configureApproximateEngine(new gum::LoopyBeliefPropagation<double>(net), scheduler, approximation);
+	case InferenceAlgs::ImportanceSampling:
+		return configureApproximateEngine(new gum::ImportanceSampling<double>(net), scheduler, approximation);
+	case InferenceAlgs::WeightedSampling:
+		return configureApproximateEngine(new gum::WeightedSampling<double>(net), scheduler, approximation);
+	case InferenceAlgs::MonteCarloSampling:
+		return configureApproximateEngine(new gum::MonteCarloSampling<double>(net), scheduler, approximation);
+	case InferenceAlgs::LoopyGibbsSampling:
+		return configureApproximateEngine(new gum::HybridGibbsSampling<double>(net), scheduler, approximation);
+	case InferenceAlgs::LoopyImportanceSampling:
+		return configureApproximateEngine(new gum::HybridImportanceSampling<double>(net), scheduler, approximation);
+	case InferenceAlgs::LoopyWeightedSampling:
+		return configureApproximateEngine(new gum::HybridWeightedSampling<double>(net), scheduler, approximation);
+	case InferenceAlgs::LoopyMonteCarloSampling:
+		return configureApproximateEngine(new gum::HybridMonteCarloSampling<double>(net), scheduler, approximation);
+	case InferenceAlgs::ArithmeticCircuit:
+		// Native engines are exact but neither scheduled nor joint targeted, they share the persisted elimination order
+		if (scheduler)
+			*scheduler = nullptr;
+		if (approximation)
+			*approximation = nullptr;
+		return new FArithmeticCircuitInference(net, compiledOrder.empty() ? nullptr : &compiledOrder);
+	case InferenceAlgs::NativeJunctionTree:
+		if (scheduler)
+			*scheduler = nullptr;
+		if (approximation)
+			*approximation = nullptr;
+		if (SinglePrecision)
+			return new FJunctionTreeInferenceF(net, compiledOrder.empty() ? nullptr : &compiledOrder);
+		return new FJunctionTreeInference(net, compiledOrder.empty() ? nullptr : &compiledOrder);
+	case InferenceAlgs::ShaferShenoy:
+	default:
+		return configureEngine(new gum::ShaferShenoyInference<double>(net), triangulation, RelevantPotentials, FindBarrenNodes, scheduler, approximation);
 	}
 }
 
-void UBayesianNetwork::makeInference()
+FBNInferenceSettings UBayesianNetwork::getInferenceSettings() const
+{
+	FBNInferenceSettings settings;
+
+	settings.maxThreads = MaxInferenceThreads;
+	settings.epsilon = ApproxEpsilon;
+	settings.minEpsilonRate = ApproxMinEpsilonRate;
+	settings.maxIterations = ApproxMaxIterations;
+	settings.maxMilliseconds = ApproxMaxMilliseconds;
+	return settings;
+}
+
+void UBayesianNetwork::applyApproximationSettings(gum::ApproximationScheme* approximation, const FBNInferenceSettings& settings)
+{
+	approximation->setEpsilon(settings.epsilon);
+	approximation->setMinEpsilonRate(settings.minEpsilonRate);
+	approximation->setMaxIter(FMath::Max(settings.maxIterations, 1));
+
+	if (settings.maxMilliseconds > 0)
+		approximation->setMaxTime(settings.maxMilliseconds / 1000.0);
+	else
+		approximation->disableMaxTime();
+}
+
+void UBayesianNetwork::ensureInference()
+{
+	if (!inference->isInferenceDone())
+		runInference(inference, inferenceScheduler, inferenceApproximation, &approximationStats);
+}
+
+void UBayesianNetwork::runInference(gum::MarginalTargetedInference<double>* engine, gum::ScheduledInference* scheduler, gum::ApproximationScheme* approximation, FBNApproximationStats* stats, const FBNInferenceSettings& settings) const
 {
+	if (approximation) {
+		applyApproximationSettings(approximation, settings);
+		engine->makeInference();
+
+		if (stats) {
+			const std::vector<double>& history = approximation->history();
+
+			stats->iterations = approximation->nbrIterations();
+			stats->milliseconds = approximation->currentTime() * 1000.0;
+			stats->epsilon = history.empty() ? 0 : history.back();
+			stats->converged = approximation->stateApproximationScheme() == gum::IApproximationSchemeConfiguration::ApproximationSchemeSTATE::Epsilon
+				|| approximation->stateApproximationScheme() == gum::IApproximationSchemeConfiguration::ApproximationSchemeSTATE::Rate;
+			stats->stoppingRule = FString(approximation->messageApproximationScheme().c_str());
+		}
+		return;
+	}
+
+	// Native engines run on the calling thread
+	if (!scheduler) {
+		engine->makeInference();
+		return;
+	}
+
+	const int32 threads = FInferenceThreadBudget::Acquire(settings.maxThreads);
+
+	scheduler->setNumberOfThreads(threads);
 	try {
-		//Init();
-		inference->makeInference();
+		engine->makeInference();
 	}
-	catch (gum::NotFound& e)
-		UE_LOG(LogTemp, Warning, TEXT("%hs from %hs"), e.errorType().c_str(), e.errorContent().c_str());
+	catch (...) {
+		FInferenceThreadBudget::Release(threads);
+		throw;
+	}
+	FInferenceThreadBudget::Release(threads);
 }
 
-TMap<FString, float> UBayesianNetwork::getPosterior(FString variable)
+void UBayesianNetwork::setInferenceThreadBudget(int32 threads)
 {
-	const std::string nodeName(TCHAR_TO_UTF8(*variable));
-	TMap<FString, float> out;
-	unsigned int j;
+	FInferenceThreadBudget::SetBudget(threads);
+}
 
-	try {
-		gum::Potential<double> result = inference->posterior(nodeName);
-		gum::Instantiation inst(result);
-		
-		for (inst.setFirst(), j=0; !inst.end(); ++inst, ++j)
-			out.Add(FString(result.variable(0).label(j).c_str()), result.get(inst));
+int32 UBayesianNetwork::getInferenceThreadBudget()
+{
+	return FInferenceThreadBudget::GetBudget();
+}
+
+#if WITH_DEV_AUTOMATION_TESTS
+TMap<int32, float> UBayesianNetwork::benchmarkInferenceThreads(int32 maxThreads, int32 repetitions)
+{
+	TMap<int32, float> out;
+	const int32 threadCount = FMath::Clamp(maxThreads, 1, FPlatformMisc::NumberOfCoresIncludingHyperthreads());
+	float baseline = 0;
+
+	repetitions = FMath::Max(repetitions, 1);
+
+	// Runs outside the global budget on purpose, it measures what the hardware can give
+	for (int32 threads = 1; threads <= threadCount; threads++) {
+		double total = 0;
+
+		for (int32 r = 0; r < repetitions; r++) {
+			gum::ScheduledInference* scheduler;
+			gum::ApproximationScheme* approximation;
+			TUniquePtr<gum::MarginalTargetedInference<double>> engine(createInference(&bn, &scheduler, &approximation));
+
+			if (!scheduler) {
+				UE_LOG(LogTemp, Warning, TEXT("%s: thread benchmark needs an exact inference algorithm"), *GetName());
+				return out;
+			}
+
+			try {
+				for (const auto& evidence : inference->evidence())
+					engine->addEvidence(*evidence.second);
+				scheduler->setNumberOfThreads(threads);
+
+				// Junction tree construction is not part of the measure
+				engine->prepareInference();
+
+				const double start = FPlatformTime::Seconds();
+				engine->makeInference();
+				total += FPlatformTime::Seconds() - start;
+			}
+			catch (gum::Exception& e) {
+				UE_LOG(LogTemp, Warning, TEXT("%hs from %hs during benchmark"), e.errorType().c_str(), e.errorContent().c_str());
+				return out;
+			}
+		}
+
+		const float ms = total * 1000.0 / repetitions;
+
+		if (threads == 1)
+			baseline = ms;
+
+		out.Add(threads, ms);
+		UE_LOG(LogTemp, Log, TEXT("%s: %d inference threads, %.3f ms, speedup %.2f"), *GetName(), threads, ms, ms > 0 ? baseline / ms : 0.0f);
 	}
-	catch (gum::NotFound& e)
-		UE_LOG(LogTemp, Warning, TEXT("%hs from %hs"), e.errorType().c_str(), e.errorContent().c_str());
-	
 	return out;
 }
+#endif
 
-void UBayesianNetwork::writeBIF(FString file)
+uint32 UBayesianNetwork::computeStructureChecksum() const
 {
-	auto writer = gum::BIFWriter<double>();
-	writer.write(TCHAR_TO_UTF8(*file), bn);
+	TArray<uint32> data;
+	TArray<gum::NodeId> ids;
+
+	for (gum::NodeId id : bn.nodes())
+		ids.Add(id);
+	ids.Sort();
+
+	for (gum::NodeId id : ids) {
+		TArray<gum::NodeId> parents;
+
+		for (gum::NodeId parent : bn.parents(id))
+			parents.Add(parent);
+		parents.Sort();
+
+		data.Add((uint32)id);
+		data.Add((uint32)bn.variable(id).domainSize());
+		data.Add((uint32)parents.Num());
+		for (gum::NodeId parent : parents)
+			data.Add((uint32)parent);
+	}
+	return FCrc::MemCrc32(data.GetData(), data.Num() * sizeof(uint32));
 }
 
-void UBayesianNetwork::erase(FString variable)
+void UBayesianNetwork::compileStructure()
 {
-	const std::string nodeName(TCHAR_TO_UTF8(*variable));
-	
-	TArray<FString> toRemove;
+	gum::UndiGraph moralGraph = bn.moralGraph();
+	gum::NodeProperty<gum::Size> domainSizes;
 
-	for (FString arc : arcs)
-		if (arc.Contains(variable))
-			toRemove.Add(arc);
+	for (gum::NodeId id : bn.nodes())
+		domainSizes.insert(id, bn.variable(id).domainSize());
 
-	for (FString arc : toRemove)
-		arcs.Remove(arc);
-	
-	bn.erase(nodeName);
-	nodeNames.Remove(variable);
-	nodeDescriptions.Remove(variable);
+	gum::DefaultTriangulation triangulation(&moralGraph, &domainSizes);
+
+	compiledStructure.eliminationOrder.Reset();
+	for (gum::NodeId id : triangulation.eliminationOrder())
+		compiledStructure.eliminationOrder.Add((int32)id);
+	compiledStructure.checksum = computeStructureChecksum();
 }
 
-void UBayesianNetwork::setBN(const FString& Filename) {
-	gum::BIFReader<double> reader(&bn, TCHAR_TO_UTF8(*Filename));
-	int result = reader.proceed();
-	unsigned int j;
-	FBayesianNodeStruct newNode;
+void UBayesianNetwork::loadCompiledStructure()
+{
+	compiledOrder.clear();
 
-	switch (InferenceAlgorithm)
-	{
-		case InferenceAlgs::Lazy_Propagation:
-			inference = new gum::LazyPropagation<double>(&bn); break;
-		case InferenceAlgs::ShaferShenoy:
-			inference = new gum::ShaferShenoyInference<double>(&bn); break;
-		case InferenceAlgs::VariableElimination:
-			inference = new gum::VariableElimination<double>(&bn); break;
+	if (compiledStructure.eliminationOrder.Num() == 0)
+		return;
+
+	if (compiledStructure.checksum != computeStructureChecksum()) {
+		UE_LOG(LogTemp, Warning, TEXT("Compiled structure of %s is out of date, the junction tree will be rebuilt at runtime"), *GetName());
+		return;
 	}
 
-	for (int i : bn.nodes()) {
-		gum::Instantiation inst(bn.cpt(i));
-		
-		newNode.variables.Empty();
-		newNode.values.Empty();
-		newNode.parents.Empty();
+	for (int32 id : compiledStructure.eliminationOrder)
+		compiledOrder.push_back(id);
+	compiledTriangulation.setOrder(&compiledOrder);
+}
 
-		for (inst.setFirst(), j = 0; !inst.end(); ++inst, j++) {
-			newNode.name = FString(bn.variable(i).name().c_str());
-			if (j < bn.variable(i).domainSize())
-				newNode.variables.Add(FString(bn.variable(i).label(j).c_str()));
-			newNode.values.Add(bn.cpt(i).get(inst));
+#if WITH_EDITOR
+void UBayesianNetwork::PreSave(FObjectPreSaveContext ObjectSaveContext)
+{
+	Super::PreSave(ObjectSaveContext);
+
+	if (bn.size() > 0) {
+		if (compiledStructure.checksum != computeStructureChecksum())
+			compileStructure();
+		cookNetwork();
+	}
+}
+#endif
+
+void UBayesianNetwork::PostLoad()
+{
+	Super::PostLoad();
+
+	if (bn.size() > 0)
+		return;
+
+	// The cooked form is the fast path, the nodes rebuild the network when it is missing or unreadable
+	if (cookedNetwork.Num() > 0 && loadCookedNetwork())
+		Init();
+	else if (serializedNodes.Num() > 0)
+		BuildFromDescription(serializedNodes);
+}
+
+bool UBayesianNetwork::cookNetwork()
+{
+	TArray<gum::NodeId> ids;
+	TArray<double> cpts;
+	int32 magic = CookedNetworkMagic;
+	int32 nodeCount;
+
+	for (gum::NodeId id : bn.nodes()) {
+		const gum::DiscreteVariable& var = bn.variable(id);
+
+		if ((var.varType() != gum::VarType::Labelized && var.varType() != gum::VarType::Discretized) || bn.cpt(id).content()->name() != "MultiDimArray") {
+			UE_LOG(LogTemp, Warning, TEXT("%s has node %hs which cannot be cooked, it will have to be rebuilt at load"), *GetName(), var.name().c_str());
+			cookedNetwork.Empty();
+			return false;
 		}
+		ids.Add(id);
+	}
+	ids.Sort();
+	nodeCount = ids.Num();
+
+	cookedNetwork.Reset();
+	FMemoryWriter writer(cookedNetwork);
+
+	writer << magic;
+	writer << nodeCount;
+
+	// Variables
+	for (gum::NodeId id : ids) {
+		const gum::DiscreteVariable& var = bn.variable(id);
+		int32 nodeId = (int32)id;
+		uint8 kind = var.varType() == gum::VarType::Discretized ? 1 : 0;
+		FString name(var.name().c_str());
+		FString description(var.description().c_str());
+
+		writer << nodeId << name << description << kind;
 
-		for (auto parent : bn.parents(i)) {
-			newNode.parents.Add(FString(bn.variable(parent).name().c_str()));
+		if (kind == 1) {
+			TArray<double> ticks;
+			for (double tick : static_cast<const gum::IDiscretizedVariable&>(var).ticksAsDoubles())
+				ticks.Add(tick);
+			writer << ticks;
 		}
+		else {
+			TArray<FString> labels;
+			for (gum::Idx j = 0; j < var.domainSize(); j++)
+				labels.Add(FString(var.label(j).c_str()));
+			writer << labels;
+		}
+	}
 
-		serializedNodes.Add(newNode);
+	// Arcs, listed per child in the order of its CPT variables so that the rebuilt CPT has the same layout
+	for (gum::NodeId id : ids) {
+		const gum::Potential<double>& cpt = bn.cpt(id);
+		TArray<int32> parents;
+
+		for (gum::Idx i = 1; i < cpt.nbrDim(); i++)
+			parents.Add((int32)bn.nodeId(cpt.variable(i)));
+		writer << parents;
+
+		gum::Instantiation inst(cpt);
+		for (inst.setFirst(); !inst.end(); inst.inc())
+			cpts.Add(cpt.get(inst));
 	}
-	initialized = true;
+
+	// One contiguous block with all the CPTs
+	cpts.BulkSerialize(writer);
+	return true;
 }
 
-void UBayesianNetwork::addLabelizedVariable(FString variable, FString description, TArray<FString> labels) {
-	if (!nodeNames.Contains(variable))
-	{
-		gum::LabelizedVariable newNode(TCHAR_TO_UTF8(*variable), TCHAR_TO_UTF8(*description), 0);
-		nodeNames.Add(variable);
-		nodeDescriptions.Add(variable, description);
+bool UBayesianNetwork::loadCookedNetwork()
+{
+	FMemoryReader reader(cookedNetwork);
+	int32 magic = 0;
+	int32 nodeCount = 0;
+	TArray<int32> ids;
+	TArray<TArray<int32>> parents;
+	TArray<double> cpts;
+
+	auto corrupt = [this]() {
+		UE_LOG(LogTemp, Warning, TEXT("Cooked network of %s is corrupt, it will be rebuilt from its nodes"), *GetName());
+		bn.clear();
+		return false;
+	};
+
+	reader << magic;
+	if (magic != CookedNetworkMagic) {
+		UE_LOG(LogTemp, Warning, TEXT("Cooked network of %s has an unknown layout"), *GetName());
+		return false;
 	}
-}
+	reader << nodeCount;
 
-void UBayesianNetwork::addDiscretizedVariable(FString variable, FString description, float minTick, float maxTick, float nPoints, BayesianNodeType nodeType) {
-	if (!nodeNames.Contains(variable))
-	{
-		gum::DiscretizedVariable<float> newNode(TCHAR_TO_UTF8(*variable), TCHAR_TO_UTF8(*description));
-		std::vector<float> ticks = myLinspace(minTick, maxTick, nPoints);
+	// Every node takes several bytes, which bounds the count of a corrupt archive
+	if (reader.IsError() || nodeCount < 0 || nodeCount > cookedNetwork.Num())
+		return corrupt();
 
-		for (float i : ticks)
-			newNode.addTick(i);
+	ids.SetNum(nodeCount);
+	parents.SetNum(nodeCount);
 
-		switch (nodeType) {
-		case BayesianNodeType::NORMAL: bn.add(newNode); break;
-		case BayesianNodeType::AMPLITUDE: bn.addAMPLITUDE(newNode); break;
-		case BayesianNodeType::AND: bn.addAND(newNode); break;
-		case BayesianNodeType::COUNT: bn.addCOUNT(newNode); break;
-		case BayesianNodeType::EXISTS: bn.addEXISTS(newNode); break;
-		case BayesianNodeType::FORALL: bn.addFORALL(newNode); break;
-		case BayesianNodeType::MAX: bn.addMAX(newNode); break;
-		case BayesianNodeType::MEDIAN: bn.addMEDIAN(newNode); break;
-		case BayesianNodeType::MIN: bn.addMIN(newNode); break;
+	try {
+		for (int32 i = 0; i < nodeCount; i++) {
+			FString name, description;
+			uint8 kind;
+
+			reader << ids[i] << name << description << kind;
+
+			if (kind == 1) {
+				TArray<double> ticks;
+				reader << ticks;
+				if (reader.IsError() || ids[i] < 0)
+					return corrupt();
+
+				gum::DiscretizedVariable<double> var(TCHAR_TO_UTF8(*name), TCHAR_TO_UTF8(*description));
+				for (double tick : ticks)
+					var.addTick(tick);
+				bn.add(var, ids[i]);
+			}
+			else {
+				TArray<FString> labels;
+				reader << labels;
+				if (reader.IsError() || ids[i] < 0)
+					return corrupt();
+
+				gum::LabelizedVariable var(TCHAR_TO_UTF8(*name), TCHAR_TO_UTF8(*description), 0);
+				for (const FString& label : labels)
+					var.addLabel(TCHAR_TO_UTF8(*label));
+				bn.add(var, ids[i]);
+			}
 		}
-		nodeNames.Add(variable);
-		nodeDescriptions.Add(variable, description);
+
+		for (int32 i = 0; i < nodeCount; i++)
+			reader << parents[i];
+		if (reader.IsError())
+			return corrupt();
+
+		cpts.BulkSerialize(reader);
+		if (reader.IsError())
+			return corrupt();
+
+		// CPTs are resized once at the end instead of once per arc
+		bn.beginTopologyTransformation();
+		for (int32 i = 0; i < nodeCount; i++)
+			for (int32 parent : parents[i])
+				bn.addArc(parent, ids[i]);
+		bn.endTopologyTransformation();
+
+		std::vector<double> values;
+		int32 offset = 0;
+
+		for (int32 i = 0; i < nodeCount; i++) {
+			const gum::Potential<double>& cpt = bn.cpt(ids[i]);
+			const int32 size = (int32)cpt.domainSize();
+
+			if (size > cpts.Num() - offset)
+				return corrupt();
+
+			values.assign(cpts.GetData() + offset, cpts.GetData() + offset + size);
+			cpt.fillWith(values);
+			offset += size;
+		}
+
+		if (offset != cpts.Num())
+			return corrupt();
 	}
+	catch (gum::Exception& e) {
+		UE_LOG(LogTemp, Warning, TEXT("%hs from %hs while loading cooked network"), e.errorType().c_str(), e.errorContent().c_str());
+		bn.clear();
+		return false;
+	}
+
+	nodeCacheDirty = true;
+	nodeGenerations.clear();
+	++modelVersion;
+	return true;
 }
 
-void UBayesianNetwork::addArc(FString parent, FString child) {
+void UBayesianNetwork::Init() {
+	if (!initialized) {	
+		initialized = true;
+	}
 
-	FString newArc = parent + "_" + child;
-	
-	for (FString arc : arcs)
-		if (arc == newArc)
+	loadCompiledStructure();
+
+	delete inference;
+	inference = createInference(&bn, &inferenceScheduler, &inferenceApproximation);
+	applyTargets(inference, inferenceScheduler != nullptr);
+	++evidenceVersion;
+}
+
+void UBayesianNetwork::makeInference()
+{
+	if (UsePosteriorCache) {
+		bool isNew;
+
+		// Known evidence configuration: posteriors are served from the cache without propagating
+		if (findPosteriorCacheEntry(isNew) && !isNew)
 			return;
+	}
 
 	try {
-		bn.addArc(TCHAR_TO_UTF8(*parent), TCHAR_TO_UTF8(*child));
-		arcs.Add(newArc);
+		//Init();
+		runInference(inference, inferenceScheduler, inferenceApproximation, &approximationStats);
 	}
-	catch (gum::NotFound& e)
-		UE_LOG(LogTemp, Warning, TEXT("%hs from %hs while adding arc"), e.errorType().c_str(), e.errorContent().c_str());
+	catch (gum::Exception& e)
+		UE_LOG(LogTemp, Warning, TEXT("%hs from %hs"), e.errorType().c_str(), e.errorContent().c_str());
 }
 
-int UBayesianNetwork::idFromName(FString variable) {
-	return bn.idFromName(TCHAR_TO_UTF8(*variable));
-}
+int32 UBayesianNetwork::acquireBatchWorkers(int32 tasks)
+{
+	const int32 threads = FInferenceThreadBudget::Acquire(tasks);
 
-void UBayesianNetwork::fillWith(FString variable, float value) {
-	try {
-		bn.cpt(TCHAR_TO_UTF8(*variable)).fillWith(value);
+	if (batchModelVersion != modelVersion || batchAlgorithm != InferenceAlgorithm || batchSinglePrecision != SinglePrecision)
+		batchWorkers.clear();
+
+	while ((int32)batchWorkers.size() < threads) {
+		std::unique_ptr<FBNBatchWorker> worker(new FBNBatchWorker());
+
+		worker->bn = bn;
+		worker->inference = createInference(&worker->bn, &worker->scheduler, &worker->approximation);
+		batchWorkers.push_back(std::move(worker));
 	}
-	catch (gum::NotFound& e)
-		UE_LOG(LogTemp, Warning, TEXT("%hs from %hs while filling"), e.errorType().c_str(), e.errorContent().c_str());
+	batchModelVersion = modelVersion;
+	batchAlgorithm = InferenceAlgorithm;
+	batchSinglePrecision = SinglePrecision;
+
+	for (int32 w = 0; w < threads; w++)
+		if (batchWorkers[w]->approximation)
+			applyApproximationSettings(batchWorkers[w]->approximation);
+
+	return threads;
 }
 
-void UBayesianNetwork::addEvidence(FString variable, TArray<float> data)
+bool UBayesianNetwork::makeInferenceBatch(TArrayView<const FBNEvidenceSet> scenarios, TArrayView<const FBNNodeHandle> targets, TArray<FBNPosteriorBuffer>& results)
 {
-	std::vector<double> vec;
-	for (const float value : data)
-		vec.push_back(value);
+	typedef std::vector<std::pair<gum::NodeId, std::vector<double>>> ScenarioEvidence;
 
-	auto var = TCHAR_TO_UTF8(*variable);
+	TArray<FBNNodeHandle> allNodes;
+	std::vector<ScenarioEvidence> evidence(scenarios.Num());
+	TArray<bool> failed;
+	TArray<bool> live;
+	bool ok = true;
 
-	try {
-		if (inference->hasEvidence(var))
-			inference->eraseEvidence(var);
-		inference->addEvidence(var, vec);
+	if (targets.Num() == 0) {
+		allNodes = getAllNodeHandles();
+		targets = allNodes;
 	}
-	catch (gum::NotFound& e)
-		UE_LOG(LogTemp, Warning, TEXT("%hs from %hs while adding evidence"), e.errorType().c_str(), e.errorContent().c_str());
 
+	// Stale handles are caught before the workers start
+	live.SetNum(targets.Num());
+	for (int32 j = 0; j < targets.Num(); j++) {
+		const FBNNodeCache* cache = findNodeCache(targets[j]);
 
-	/*if (variable == "109064338") {
-		for (float v : vec) {
-			UE_LOG(LogTemp, Warning, TEXT("%hs"), TCHAR_TO_UTF8(*variable));
-			UE_LOG(LogTemp, Warning, TEXT("%hf"), v);
-			inference->makeInference();
-			UE_LOG(LogTemp, Warning, TEXT("%hg"), inference->H(var));
+		live[j] = cache && cache->labels.Num() == targets[j].domainSize;
+		if (!live[j] && targets[j].IsValid()) {
+			UE_LOG(LogTemp, Warning, TEXT("Stale target handle %d"), targets[j].id);
+			ok = false;
 		}
-	}*/
-}
+	}
 
-TArray<FString> UBayesianNetwork::getMarkovBlanketNodes(FString variable) {
-	gum::MarkovBlanket markovBlanket = gum::MarkovBlanket(bn, TCHAR_TO_UTF8(*variable));
+	// Names are resolved here, workers only see node ids
+	for (int32 i = 0; i < scenarios.Num(); i++) {
+		for (const FBNEvidenceItem& item : scenarios[i].evidence) {
+			const FBNNodeHandle node = getNodeHandle(item.variable);
 
-	TArray<FString> markovBlaketNodes;
+			if (!node.IsValid() || node.domainSize != item.values.Num()) {
+				UE_LOG(LogTemp, Warning, TEXT("Invalid evidence on %s in scenario %d"), *item.variable, i);
+				ok = false;
+				continue;
+			}
+			evidence[i].emplace_back(node.id, std::vector<double>(item.values.begin(), item.values.end()));
+		}
+	}
 
-	for (auto node : markovBlanket.nodes())
-		markovBlaketNodes.Add(bn.variable(node).name().c_str());
+	results.SetNum(scenarios.Num());
+	failed.Init(false, scenarios.Num());
+	for (FBNPosteriorBuffer& result : results) {
+		int32 total = 0;
 
-	return markovBlaketNodes;
-}
+		result.offsets.SetNumUninitialized(targets.Num() + 1, false);
+		for (int32 j = 0; j < targets.Num(); j++) {
+			result.offsets[j] = total;
+			total += FMath::Max(targets[j].domainSize, 0);
+		}
+		result.offsets[targets.Num()] = total;
+		result.values.SetNumZeroed(total, false);
+	}
 
-void UBayesianNetwork::eraseAllEvidence()
-{
-	inference->eraseAllEvidence();
+	if (scenarios.Num() == 0)
+		return ok;
+
+	const int32 threads = acquireBatchWorkers(scenarios.Num());
+	std::atomic<int32> next(0);
+
+	ParallelFor(threads, [&](int32 w) {
+		FBNBatchWorker& worker = *batchWorkers[w];
+
+		for (int32 i = next++; i < scenarios.Num(); i = next++) {
+			FBNPosteriorBuffer& result = results[i];
+
+			try {
+				worker.inference->eraseAllEvidence();
+				for (const auto& item : evidence[i])
+					worker.inference->addEvidence(item.first, item.second);
+				worker.inference->makeInference();
+
+				for (int32 j = 0; j < targets.Num(); j++) {
+					if (!live[j])
+						continue;
+
+					const gum::Potential<double>& posterior = worker.inference->posterior(targets[j].id);
+					gum::Instantiation inst(posterior);
+					int32 k = result.offsets[j];
+
+					for (inst.setFirst(); !inst.end() && k < result.offsets[j + 1]; inst.inc(), ++k)
+						result.values[k] = posterior.get(inst);
+				}
+			}
+			catch (gum::Exception& e) {
+				UE_LOG(LogTemp, Warning, TEXT("%hs from %hs in scenario %d"), e.errorType().c_str(), e.errorContent().c_str(), i);
+				failed[i] = true;
+			}
+		}
+	});
+
+	FInferenceThreadBudget::Release(threads);
+
+	for (int32 i = 0; i < scenarios.Num(); i++) {
+		if (failed[i]) {
+			FMemory::Memzero(results[i].values.GetData(), results[i].values.Num() * sizeof(float));
+			ok = false;
+		}
+	}
+	return ok;
 }
 
-void UBayesianNetwork::eraseEvidence(FString variable)
+bool UBayesianNetwork::makeInferenceBatchByHandle(const TArray<FBNEvidenceSet>& scenarios, const TArray<FBNNodeHandle>& targets, TArray<FBNPosteriorBuffer>& results)
 {
-	inference->eraseEvidence(TCHAR_TO_UTF8(*variable));
+	return makeInferenceBatch(scenarios, targets, results);
 }
 
-double UBayesianNetwork::getEntropy(FString variable)
+TArray<FBNInformationGain> UBayesianNetwork::rankByExpectedInformationGain(const FBNNodeHandle& target, TArrayView<const FBNNodeHandle> candidates)
 {
-	if (!variable.IsEmpty())
-		return (float) inference->H(TCHAR_TO_UTF8(*variable));
-	return 0;
-}
+	struct FOutcome
+	{
+		int32 candidate;
+		gum::Idx value;
+		double probability;
+		double entropy;
+	};
 
+	// The outcomes of one candidate, outcomes[first] to outcomes[last - 1], and its soft evidence if any
+	struct FCandidateTask
+	{
+		int32 first;
+		int32 last;
+		gum::NodeId id;
+		const std::vector<double>* likelihood;
+	};
+
+	TArray<FBNInformationGain> out;
+	TArray<FOutcome> outcomes;
+	TArray<FCandidateTask> tasks;
+	std::vector<std::pair<gum::NodeId, std::vector<double>>> evidence;
+	std::atomic<bool> failed(false);
+	double prior;
+
+	if (!findNodeCache(target))
+		return out;
+
+	// Outcome probabilities come from the main engine, only the conditioned runs are farmed out
+	try {
+		ensureInference();
+		prior = inference->H(target.id);
+
+		for (int32 i = 0; i < candidates.Num(); i++) {
+			FBNInformationGain& item = out.AddDefaulted_GetRef();
+
+			item.node = candidates[i];
+			if (!findNodeCache(candidates[i]))
+				continue;
+			item.variable = FString(bn.variable(candidates[i].id).name().c_str());
+
+			// Already observed, nothing left to learn. Soft evidence, an uncertain reading, is worth confirming
+			if (inference->hasHardEvidence(candidates[i].id))
+				continue;
+
+			const gum::Potential<double>& posterior = inference->posterior(candidates[i].id);
+			gum::Instantiation inst(posterior);
+			FCandidateTask& task = tasks.AddDefaulted_GetRef();
+
+			task.first = outcomes.Num();
+			task.id = candidates[i].id;
+			task.likelihood = nullptr;
+			for (inst.setFirst(); !inst.end(); inst.inc())
+				if (posterior.get(inst) > 0)
+					outcomes.Add({ i, inst.val(0), posterior.get(inst), 0 });
+			task.last = outcomes.Num();
+		}
+
+		for (const auto& item : inference->evidence()) {
+			evidence.emplace_back(item.first, std::vector<double>());
+			potentialToVector(*item.second, evidence.back().second);
+		}
+		for (FCandidateTask& task : tasks)
+			for (const auto& item : evidence)
+				if (item.first == task.id)
+					task.likelihood = &item.second;
+	}
+	catch (gum::Exception& e) {
+		UE_LOG(LogTemp, Warning, TEXT("%hs from %hs"), e.errorType().c_str(), e.errorContent().c_str());
+		out.Reset();
+		return out;
+	}
+
+	if (tasks.Num() > 0) {
+		const int32 threads = acquireBatchWorkers(tasks.Num());
+		std::atomic<int32> next(0);
+
+		// A worker enters the current evidence once, then each outcome only changes the candidate's evidence.
+		// aGrUM takes a one-hot likelihood for hard evidence, which reshapes the junction tree of Lazy Propagation,
+		// so the first outcome of a candidate builds a tree and its other outcomes reuse it through chgEvidence
+		ParallelFor(threads, [&](int32 w) {
+			FBNBatchWorker& worker = *batchWorkers[w];
+			bool loaded = false;
+
+			for (int32 t = next++; t < tasks.Num(); t = next++) {
+				const FCandidateTask& task = tasks[t];
+
+				try {
+					if (!loaded) {
+						worker.inference->eraseAllEvidence();
+						for (const auto& item : evidence)
+							worker.inference->addEvidence(item.first, item.second);
+						loaded = true;
+					}
+
+					for (int32 k = task.first; k < task.last; k++) {
+						FOutcome& outcome = outcomes[k];
+
+						if (worker.inference->hasEvidence(task.id))
+							worker.inference->chgEvidence(task.id, outcome.value);
+						else
+							worker.inference->addEvidence(task.id, outcome.value);
+						worker.inference->makeInference();
+						outcome.entropy = worker.inference->H(target.id);
+					}
+
+					// Back to the current evidence for the next candidate
+					if (task.likelihood)
+						worker.inference->chgEvidence(task.id, *task.likelihood);
+					else if (worker.inference->hasEvidence(task.id))
+						worker.inference->eraseEvidence(task.id);
+				}
+				catch (gum::Exception& e) {
+					UE_LOG(LogTemp, Warning, TEXT("%hs from %hs while ranking questions"), e.errorType().c_str(), e.errorContent().c_str());
+					failed = true;
+					loaded = false;
+				}
+			}
+		});
+
+		FInferenceThreadBudget::Release(threads);
+	}
+
+	if (failed) {
+		out.Reset();
+		return out;
+	}
+
+	for (FBNInformationGain& item : out)
+		if (item.variable.Len() > 0 && !inference->hasHardEvidence(item.node.id))
+			item.gain = prior;
+
+	for (const FOutcome& outcome : outcomes)
+		out[outcome.candidate].gain -= outcome.probability * outcome.entropy;
+
+	for (FBNInformationGain& item : out)
+		item.gain = FMath::Max(item.gain, 0.0f);
+
+	out.StableSort([](const FBNInformationGain& a, const FBNInformationGain& b) { return a.gain > b.gain; });
+	return out;
+}
+
+TArray<FBNInformationGain> UBayesianNetwork::rankByExpectedInformationGainByHandle(const FBNNodeHandle& target, const TArray<FBNNodeHandle>& candidates)
+{
+	return rankByExpectedInformationGain(target, candidates);
+}
+
+TArray<FBNInformationGain> UBayesianNetwork::rankByExpectedInformationGainByName(FString target, const TArray<FString>& candidates)
+{
+	TArray<FBNNodeHandle, TInlineAllocator<64>> nodes;
+
+	for (const FString& variable : candidates)
+		nodes.Add(getNodeHandle(variable));
+
+	return rankByExpectedInformationGain(getNodeHandle(target), nodes);
+}
+
+bool UBayesianNetwork::computeMutualInformationMatrix(TArrayView<const FBNNodeHandle> nodes, FBNMutualInformationMatrix& result)
+{
+	TArray<FBNNodeHandle> allNodes;
+	TArray<int32> offsets;
+	TArray<double> marginals;
+	std::vector<std::pair<gum::NodeId, std::vector<double>>> evidence;
+	std::atomic<bool> failed(false);
+
+	if (nodes.Num() == 0) {
+		allNodes = getAllNodeHandles();
+		nodes = allNodes;
+	}
+
+	const int32 n = nodes.Num();
+
+	result.nodes = TArray<FBNNodeHandle>(nodes.GetData(), n);
+	result.variables.Reset(n);
+	result.values.SetNumZeroed(n * n);
+
+	// Marginals under the current evidence come from the main engine, P(X) for every X and P(y) for every row
+	try {
+		ensureInference();
+		for (const FBNNodeHandle& node : nodes) {
+			offsets.Add(marginals.Num());
+
+			if (!findNodeCache(node)) {
+				result.variables.Add(FString());
+				continue;
+			}
+			result.variables.Add(FString(bn.variable(node.id).name().c_str()));
+
+			const gum::Potential<double>& posterior = inference->posterior(node.id);
+			gum::Instantiation inst(posterior);
+
+			for (inst.setFirst(); !inst.end(); inst.inc())
+				marginals.Add(posterior.get(inst));
+		}
+		offsets.Add(marginals.Num());
+
+		for (const auto& item : inference->evidence()) {
+			evidence.emplace_back(item.first, std::vector<double>());
+			potentialToVector(*item.second, evidence.back().second);
+		}
+	}
+	catch (gum::Exception& e) {
+		UE_LOG(LogTemp, Warning, TEXT("%hs from %hs"), e.errorType().c_str(), e.errorContent().c_str());
+		return false;
+	}
+
+	if (n < 2)
+		return true;
+
+	// Row i only fills the columns after i, the matrix is mirrored afterwards
+	const int32 threads = acquireBatchWorkers(n - 1);
+	std::atomic<int32> next(0);
+
+	ParallelFor(threads, [&](int32 w) {
+		FBNBatchWorker& worker = *batchWorkers[w];
+
+		for (int32 i = next++; i < n - 1; i = next++) {
+			const gum::NodeId row = nodes[i].id;
+
+			if (result.variables[i].IsEmpty() || inference->hardEvidenceNodes().contains(row))
+				continue;
+
+			try {
+				for (gum::Idx y = 0; y < (gum::Idx)(offsets[i + 1] - offsets[i]); y++) {
+					const double py = marginals[offsets[i] + y];
+
+					if (py <= 0)
+						continue;
+
+					// Conditioning on Y = y replaces any soft evidence on Y
+					worker.inference->eraseAllEvidence();
+					for (const auto& item : evidence)
+						if (item.first != row)
+							worker.inference->addEvidence(item.first, item.second);
+					worker.inference->addEvidence(row, y);
+					worker.inference->makeInference();
+
+					// I(X;Y) = sum_y P(y) KL(P(X|y) || P(X))
+					for (int32 j = i + 1; j < n; j++) {
+						if (result.variables[j].IsEmpty() || nodes[j].id == nodes[i].id)
+							continue;
+
+						const gum::Potential<double>& posterior = worker.inference->posterior(nodes[j].id);
+						gum::Instantiation inst(posterior);
+						double kl = 0;
+						int32 k = offsets[j];
+
+						for (inst.setFirst(); !inst.end(); inst.inc(), ++k) {
+							const double px = marginals[k];
+							const double pxy = posterior.get(inst);
+
+							if (pxy > 0 && px > 0)
+								kl += pxy * FMath::Log2(pxy / px);
+						}
+						result.values[i * n + j] += py * kl;
+					}
+				}
+			}
+			catch (gum::Exception& e) {
+				UE_LOG(LogTemp, Warning, TEXT("%hs from %hs while computing mutual information"), e.errorType().c_str(), e.errorContent().c_str());
+				failed = true;
+			}
+		}
+	});
+
+	FInferenceThreadBudget::Release(threads);
+
+	for (int32 i = 0; i < n; i++) {
+		for (int32 j = i + 1; j < n; j++) {
+			result.values[i * n + j] = FMath::Max(result.values[i * n + j], 0.0f);
+			result.values[j * n + i] = result.values[i * n + j];
+		}
+	}
+	return !failed;
+}
+
+bool UBayesianNetwork::computeMutualInformationMatrixByName(const TArray<FString>& variables, FBNMutualInformationMatrix& result)
+{
+	TArray<FBNNodeHandle, TInlineAllocator<64>> nodes;
+
+	for (const FString& variable : variables)
+		nodes.Add(getNodeHandle(variable));
+
+	return computeMutualInformationMatrix(nodes, result);
+}
+
+void UBayesianNetwork::analyzeMutualInformation()
+{
+	TArray<TPair<float, int32>> coupling;
+	const double start = FPlatformTime::Seconds();
+
+	if (!computeMutualInformationMatrixByName(AnalysisNodes, MutualInformation))
+		UE_LOG(LogTemp, Warning, TEXT("%s: mutual information matrix is incomplete"), *GetName());
+
+	const int32 n = MutualInformation.nodes.Num();
+
+	// Strongest link of each node to the rest of the subset; the weakest of these are the first to prune
+	for (int32 i = 0; i < n; i++) {
+		float strongest = 0;
+
+		for (int32 j = 0; j < n; j++)
+			if (j != i)
+				strongest = FMath::Max(strongest, MutualInformation.get(i, j));
+		coupling.Add(TPair<float, int32>(strongest, i));
+	}
+	coupling.Sort([](const TPair<float, int32>& a, const TPair<float, int32>& b) { return a.Key < b.Key; });
+
+	UE_LOG(LogTemp, Log, TEXT("%s: mutual information over %d nodes in %.1f ms"), *GetName(), n, (FPlatformTime::Seconds() - start) * 1000.0);
+	for (int32 i = 0; i < FMath::Min(n, 10); i++)
+		UE_LOG(LogTemp, Log, TEXT("  %s: max I = %.5f bits"), *MutualInformation.variables[coupling[i].Value], coupling[i].Key);
+}
+
+void UBayesianNetwork::applyTargets(gum::MarginalTargetedInference<double>* engine, bool exact)
+{
+	try {
+		if (TargetsOnly) {
+			engine->eraseAllTargets();
+			for (const FString& variable : InferenceTargets) {
+				const FBNNodeHandle node = getNodeHandle(variable);
+
+				if (node.IsValid())
+					engine->addTarget(node.id);
+			}
+		}
+		else
+			engine->addAllTargets();
+
+		if (!exact) {
+			if (JointTargets.Num() > 0)
+				UE_LOG(LogTemp, Warning, TEXT("%s: joint targets need an exact inference algorithm"), *GetName());
+			return;
+		}
+
+		// Exact engines are all joint targeted, see createInference
+		gum::JointTargetedInference<double>* joint = static_cast<gum::JointTargetedInference<double>*>(engine);
+
+		joint->eraseAllJointTargets();
+		for (const FBNJointTarget& target : JointTargets) {
+			gum::NodeSet set;
+
+			for (const FString& variable : target.variables) {
+				const FBNNodeHandle node = getNodeHandle(variable);
+
+				if (node.IsValid())
+					set.insert(node.id);
+			}
+			if (set.size() > 1)
+				joint->addJointTarget(set);
+		}
+	}
+	catch (gum::Exception& e)
+		UE_LOG(LogTemp, Warning, TEXT("%hs from %hs while setting targets"), e.errorType().c_str(), e.errorContent().c_str());
+}
+
+void UBayesianNetwork::rebuildInference()
+{
+	std::vector<std::pair<gum::NodeId, std::vector<double>>> evidence;
+
+	for (const auto& item : inference->evidence()) {
+		evidence.emplace_back(item.first, std::vector<double>());
+		potentialToVector(*item.second, evidence.back().second);
+	}
+
+	delete inference;
+	inference = createInference(&bn, &inferenceScheduler, &inferenceApproximation);
+	applyTargets(inference, inferenceScheduler != nullptr);
+
+	try {
+		for (const auto& item : evidence)
+			inference->addEvidence(item.first, item.second);
+	}
+	catch (gum::Exception& e)
+		UE_LOG(LogTemp, Warning, TEXT("%hs from %hs while restoring evidence"), e.errorType().c_str(), e.errorContent().c_str());
+	++evidenceVersion;
+}
+
+void UBayesianNetwork::setInferenceTargets(const TArray<FString>& targets, bool targetsOnly)
+{
+	InferenceTargets = targets;
+	TargetsOnly = targetsOnly;
+	applyTargets(inference, inferenceScheduler != nullptr);
+}
+
+void UBayesianNetwork::addJointTarget(const TArray<FString>& variables)
+{
+	JointTargets.Add(FBNJointTarget{ variables });
+	applyTargets(inference, inferenceScheduler != nullptr);
+}
+
+void UBayesianNetwork::eraseAllJointTargets()
+{
+	JointTargets.Empty();
+	applyTargets(inference, inferenceScheduler != nullptr);
+}
+
+void UBayesianNetwork::setRelevancePruning(BNRelevantPotentials relevantPotentials, bool findBarrenNodes)
+{
+	RelevantPotentials = relevantPotentials;
+	FindBarrenNodes = findBarrenNodes;
+	rebuildInference();
+}
+
+bool UBayesianNetwork::getMPE(TMap<FString, FString>& states, float& probability)
+{
+	std::vector<gum::NodeId> nodes;
+
+	for (gum::NodeId id : bn.nodes())
+		nodes.push_back(id);
+	return solveMAP(nodes, states, probability);
+}
+
+bool UBayesianNetwork::getMAP(const TArray<FString>& variables, TMap<FString, FString>& states, float& probability)
+{
+	std::vector<gum::NodeId> nodes;
+
+	try {
+		for (const FString& variable : variables)
+			nodes.push_back(bn.idFromName(TCHAR_TO_UTF8(*variable)));
+	}
+	catch (gum::NotFound& e) {
+		UE_LOG(LogTemp, Warning, TEXT("%hs from %hs"), e.errorType().c_str(), e.errorContent().c_str());
+		states.Reset();
+		probability = 0;
+		return false;
+	}
+	return solveMAP(nodes, states, probability);
+}
+
+bool UBayesianNetwork::solveMAP(const std::vector<gum::NodeId>& nodes, TMap<FString, FString>& states, float& probability)
+{
+	FMaxProductElimination solver;
+
+	states.Reset();
+	probability = 0;
+
+	if (!inference) {
+		UE_LOG(LogTemp, Warning, TEXT("%s: not initialized"), *GetName());
+		return false;
+	}
+
+	// Same evidence as the posteriors; max-product elimination over the persisted order, as aGrUM 1.7 has no MPE
+	try {
+		solver.solve(bn, inference->evidence(), nodes, compiledOrder.empty() ? nullptr : &compiledOrder);
+	}
+	catch (gum::Exception& e) {
+		UE_LOG(LogTemp, Warning, TEXT("%hs from %hs"), e.errorType().c_str(), e.errorContent().c_str());
+		return false;
+	}
+
+	for (size_t i = 0; i < nodes.size(); i++) {
+		const gum::DiscreteVariable& variable = bn.variable(nodes[i]);
+
+		states.Add(FString(variable.name().c_str()), FString(variable.label(solver.states[i]).c_str()));
+	}
+	probability = FMath::Exp(solver.logJoint - solver.logEvidence);
+	return true;
+}
+
+void UBayesianNetwork::setSinglePrecision(bool singlePrecision)
+{
+	SinglePrecision = singlePrecision;
+	if (SinglePrecision && InferenceAlgorithm != InferenceAlgs::NativeJunctionTree)
+		UE_LOG(LogTemp, Warning, TEXT("%s: single precision only applies to the Native Junction Tree algorithm"), *GetName());
+	rebuildInference();
+}
+
+bool UBayesianNetwork::getJointPosterior(const TArray<FString>& variables, TArray<float>& values)
+{
+	gum::NodeSet set;
+	gum::Instantiation inst;
+
+	values.Reset();
+	if (!inferenceScheduler) {
+		UE_LOG(LogTemp, Warning, TEXT("%s: joint posteriors need an exact inference algorithm"), *GetName());
+		return false;
+	}
+
+	try {
+		for (const FString& variable : variables) {
+			const FBNNodeHandle node = getNodeHandle(variable);
+
+			if (!node.IsValid())
+				return false;
+			set.insert(node.id);
+			inst.add(bn.variable(node.id));
+		}
+
+		const gum::Potential<double>& result = static_cast<gum::JointTargetedInference<double>*>(inference)->jointPosterior(set);
+
+		for (inst.setFirst(); !inst.end(); inst.inc())
+			values.Add(result.get(inst));
+	}
+	catch (gum::Exception& e) {
+		UE_LOG(LogTemp, Warning, TEXT("%hs from %hs"), e.errorType().c_str(), e.errorContent().c_str());
+		values.Reset();
+		return false;
+	}
+	return true;
+}
+
+#if WITH_DEV_AUTOMATION_TESTS
+TMap<FString, float> UBayesianNetwork::benchmarkTargetedInference(int32 repetitions)
+{
+	TMap<FString, float> out;
+	TArray<gum::NodeId> reads;
+	const bool targetsOnly = TargetsOnly;
+
+	repetitions = FMath::Max(repetitions, 1);
+
+	for (const FString& variable : InferenceTargets) {
+		const FBNNodeHandle node = getNodeHandle(variable);
+
+		if (node.IsValid())
+			reads.Add(node.id);
+	}
+
+	// Both runs read the same posteriors, only the declared targets differ
+	for (int32 targeted = 0; targeted < 2; targeted++) {
+		double total = 0;
+
+		TargetsOnly = targeted == 1;
+		for (int32 r = 0; r < repetitions; r++) {
+			gum::ScheduledInference* scheduler;
+			gum::ApproximationScheme* approximation;
+			TUniquePtr<gum::MarginalTargetedInference<double>> engine(createInference(&bn, &scheduler, &approximation));
+
+			applyTargets(engine.Get(), scheduler != nullptr);
+
+			try {
+				for (const auto& evidence : inference->evidence())
+					engine->addEvidence(*evidence.second);
+
+				// Junction tree construction is not part of the measure
+				engine->prepareInference();
+
+				const double start = FPlatformTime::Seconds();
+				engine->makeInference();
+				for (gum::NodeId id : reads)
+					engine->posterior(id);
+				total += FPlatformTime::Seconds() - start;
+			}
+			catch (gum::Exception& e) {
+				UE_LOG(LogTemp, Warning, TEXT("%hs from %hs during benchmark"), e.errorType().c_str(), e.errorContent().c_str());
+				TargetsOnly = targetsOnly;
+				return out;
+			}
+		}
+
+		out.Add(targeted ? TEXT("targeted") : TEXT("full"), total * 1000.0 / repetitions);
+	}
+	TargetsOnly = targetsOnly;
+
+	UE_LOG(LogTemp, Log, TEXT("%s: full %.3f ms, targeted (%d targets) %.3f ms"), *GetName(), out[TEXT("full")], reads.Num(), out[TEXT("targeted")]);
+	return out;
+}
+
+bool UBayesianNetwork::compareInference(gum::MarginalTargetedInference<double>& reference, const FString& referenceName, gum::MarginalTargetedInference<double>& engine, const FString& name, int32 queries, TMap<FString, float>& out)
+{
+	FRandomStream random(1234);
+	std::vector<std::vector<std::pair<gum::NodeId, gum::Idx>>> scenarios;
+	gum::Instantiation sample;
+	double referenceTotal = 0;
+	double engineTotal = 0;
+	double maxError = 0;
+
+	queries = FMath::Max(queries, 1);
+
+	for (gum::NodeId id : bn.nodes())
+		sample.add(bn.variable(id));
+
+	// Forward sampling keeps every scenario possible, even with deterministic CPTs
+	for (int32 q = 0; q < queries; q++) {
+		auto& scenario = scenarios.emplace_back();
+
+		for (gum::NodeId id : bn.topologicalOrder()) {
+			const gum::DiscreteVariable& variable = bn.variable(id);
+			const double u = random.GetFraction();
+			double cumulated = 0;
+			gum::Idx j;
+
+			for (j = 0; j + 1 < variable.domainSize(); j++) {
+				sample.chgVal(variable, j);
+				cumulated += bn.cpt(id).get(sample);
+				if (u < cumulated)
+					break;
+			}
+			sample.chgVal(variable, j);
+
+			if (random.GetFraction() < 0.25f)
+				scenario.emplace_back(id, j);
+		}
+	}
+
+	try {
+		for (const auto& scenario : scenarios) {
+			double start = FPlatformTime::Seconds();
+
+			reference.eraseAllEvidence();
+			for (const auto& item : scenario)
+				reference.addEvidence(item.first, item.second);
+			reference.makeInference();
+			for (gum::NodeId id : bn.nodes())
+				reference.posterior(id);
+			referenceTotal += FPlatformTime::Seconds() - start;
+
+			start = FPlatformTime::Seconds();
+			engine.eraseAllEvidence();
+			for (const auto& item : scenario)
+				engine.addEvidence(item.first, item.second);
+			engine.makeInference();
+			for (gum::NodeId id : bn.nodes())
+				engine.posterior(id);
+			engineTotal += FPlatformTime::Seconds() - start;
+
+			for (gum::NodeId id : bn.nodes()) {
+				const gum::Potential<double>& expected = reference.posterior(id);
+				const gum::Potential<double>& actual = engine.posterior(id);
+				gum::Instantiation inst(expected);
+
+				for (inst.setFirst(); !inst.end(); inst.inc())
+					maxError = FMath::Max(maxError, FMath::Abs(expected.get(inst) - actual.get(inst)));
+			}
+		}
+	}
+	catch (gum::Exception& e) {
+		UE_LOG(LogTemp, Warning, TEXT("%hs from %hs during benchmark"), e.errorType().c_str(), e.errorContent().c_str());
+		return false;
+	}
+
+	out.Add(referenceName + TEXT("Ms"), referenceTotal * 1000.0 / queries);
+	out.Add(name + TEXT("Ms"), engineTotal * 1000.0 / queries);
+	out.Add(TEXT("maxError"), maxError);
+	return true;
+}
+
+TMap<FString, float> UBayesianNetwork::benchmarkArithmeticCircuit(int32 queries)
+{
+	TMap<FString, float> out;
+	const double compileStart = FPlatformTime::Seconds();
+	FArithmeticCircuitInference circuit(&bn, compiledOrder.empty() ? nullptr : &compiledOrder);
+
+	try {
+		circuit.prepareInference();
+	}
+	catch (gum::Exception& e) {
+		UE_LOG(LogTemp, Warning, TEXT("%hs from %hs while compiling the circuit"), e.errorType().c_str(), e.errorContent().c_str());
+		return out;
+	}
+	out.Add(TEXT("compileMs"), (FPlatformTime::Seconds() - compileStart) * 1000.0);
+	out.Add(TEXT("circuitNodes"), circuit.circuit().size());
+	out.Add(TEXT("circuitEdges"), circuit.circuit().edges());
+
+	gum::LazyPropagation<double> lazy(&bn);
+
+	if (!compiledOrder.empty())
+		lazy.setTriangulation(compiledTriangulation);
+	lazy.setNumberOfThreads(1);
+
+	if (compareInference(lazy, TEXT("lazy"), circuit, TEXT("circuit"), queries, out))
+		UE_LOG(LogTemp, Log, TEXT("%s: circuit of %d nodes, lazy %.3f ms, circuit %.3f ms per query, max error %g"), *GetName(), circuit.circuit().size(), out[TEXT("lazyMs")], out[TEXT("circuitMs")], out[TEXT("maxError")]);
+	return out;
+}
+
+TMap<FString, float> UBayesianNetwork::benchmarkNativeJunctionTree(int32 queries)
+{
+	TMap<FString, float> out;
+	const double compileStart = FPlatformTime::Seconds();
+	FJunctionTreeInference native(&bn, compiledOrder.empty() ? nullptr : &compiledOrder);
+
+	try {
+		native.prepareInference();
+	}
+	catch (gum::Exception& e) {
+		UE_LOG(LogTemp, Warning, TEXT("%hs from %hs while compiling the junction tree"), e.errorType().c_str(), e.errorContent().c_str());
+		return out;
+	}
+	out.Add(TEXT("compileMs"), (FPlatformTime::Seconds() - compileStart) * 1000.0);
+	out.Add(TEXT("tableSize"), native.tableSize());
+
+	gum::LazyPropagation<double> lazy(&bn);
+
+	if (!compiledOrder.empty())
+		lazy.setTriangulation(compiledTriangulation);
+	lazy.setNumberOfThreads(1);
+
+	if (compareInference(lazy, TEXT("lazy"), native, TEXT("native"), queries, out))
+		UE_LOG(LogTemp, Log, TEXT("%s: tables of %d entries, lazy %.3f ms, native %.3f ms per query, max error %g"), *GetName(), native.tableSize(), out[TEXT("lazyMs")], out[TEXT("nativeMs")], out[TEXT("maxError")]);
+	return out;
+}
+
+TMap<FString, float> UBayesianNetwork::benchmarkSinglePrecision(int32 queries)
+{
+	TMap<FString, float> out;
+	FJunctionTreeInference native(&bn, compiledOrder.empty() ? nullptr : &compiledOrder);
+	FJunctionTreeInferenceF single(&bn, compiledOrder.empty() ? nullptr : &compiledOrder);
+
+	try {
+		native.prepareInference();
+		single.prepareInference();
+	}
+	catch (gum::Exception& e) {
+		UE_LOG(LogTemp, Warning, TEXT("%hs from %hs while compiling the junction tree"), e.errorType().c_str(), e.errorContent().c_str());
+		return out;
+	}
+	out.Add(TEXT("doubleBytes"), native.tableBytes());
+	out.Add(TEXT("singleBytes"), single.tableBytes());
+
+	if (compareInference(native, TEXT("double"), single, TEXT("single"), queries, out))
+		UE_LOG(LogTemp, Log, TEXT("%s: tables of %lld bytes in double, %lld in single, %.3f ms against %.3f ms per query, max error %g"), *GetName(), native.tableBytes(), single.tableBytes(), out[TEXT("doubleMs")], out[TEXT("singleMs")], out[TEXT("maxError")]);
+	return out;
+}
+#endif
+
+void UBayesianNetwork::prepareLearning()
+{
+	if (learningModelVersion == modelVersion && !learningNodes.empty())
+		return;
+
+	if (learningSamples > 0)
+		UE_LOG(LogTemp, Warning, TEXT("%s: model changed, dropping %lld learning samples"), *GetName(), learningSamples);
+
+	if (nodeCacheDirty)
+		rebuildNodeCache();
+
+	int32 total = 0;
+
+	learningNodes.clear();
+	learningNodes.resize(nodeCache.size());
+
+	for (gum::NodeId id : bn.nodes()) {
+		const gum::Potential<double>& cpt = bn.cpt(id);
+		FBNLearningNode& node = learningNodes[id];
+		int32 stride = 1;
+
+		node.offset = total;
+		for (gum::Idx k = 0; k < cpt.nbrDim(); k++) {
+			node.vars.push_back(bn.nodeId(cpt.variable(k)));
+			node.strides.push_back(stride);
+			stride *= cpt.variable(k).domainSize();
+		}
+		total += stride;
+	}
+
+	learningCounts.SetNumZeroed(total);
+	learningSamples = 0;
+	learningModelVersion = modelVersion;
+}
+
+void UBayesianNetwork::recordSample(TArrayView<const int32> values)
+{
+	prepareLearning();
+
+	for (const FBNLearningNode& node : learningNodes) {
+		int32 index = node.offset;
+		size_t k;
+
+		for (k = 0; k < node.vars.size(); k++) {
+			const int32 value = (int32)node.vars[k] < values.Num() ? values[node.vars[k]] : -1;
+
+			if (value < 0)
+				break;
+			index += value * node.strides[k];
+		}
+
+		if (!node.vars.empty() && k == node.vars.size())
+			learningCounts[index] += 1;
+	}
+
+	if (++learningSamples >= LearningFoldInterval && LearningFoldInterval > 0)
+		applyLearnedParameters();
+}
+
+void UBayesianNetwork::recordObservation()
+{
+	TArray<int32, TInlineAllocator<256>> values;
+
+	if (nodeCacheDirty)
+		rebuildNodeCache();
+
+	values.Init(-1, nodeCache.size());
+	for (const auto& item : inference->hardEvidence())
+		values[item.first] = item.second;
+
+	recordSample(values);
+}
+
+void UBayesianNetwork::applyLearnedParameters()
+{
+	std::vector<double> values;
+	const double strength = FMath::Max(LearningPriorStrength, 0.0f);
+
+	prepareLearning();
+	if (learningSamples == 0)
+		return;
+
+	for (gum::NodeId id = 0; id < learningNodes.size(); id++) {
+		const FBNLearningNode& node = learningNodes[id];
+
+		// aGrUM puts the node itself first in its CPT, parents follow
+		if (node.vars.empty() || node.vars[0] != id)
+			continue;
+
+		const int32 childSize = node.strides.size() > 1 ? node.strides[1] : bn.variable(id).domainSize();
+		const gum::Potential<double>& cpt = bn.cpt(id);
+		bool updated = false;
+
+		potentialToVector(cpt, values);
+
+		for (size_t config = 0; config < values.size(); config += childSize) {
+			double n = 0;
+
+			for (int32 c = 0; c < childSize; c++)
+				n += learningCounts[node.offset + config + c];
+			if (n <= 0 || n + strength <= 0)
+				continue;
+
+			for (int32 c = 0; c < childSize; c++)
+				values[config + c] = (learningCounts[node.offset + config + c] + strength * values[config + c]) / (n + strength);
+			updated = true;
+		}
+
+		if (updated)
+			cpt.fillWith(values);
+	}
+
+	FMemory::Memzero(learningCounts.GetData(), learningCounts.Num() * sizeof(float));
+	learningSamples = 0;
+
+	// The counts still match the new version, async and batch engines pick the CPTs up on their next run
+	++modelVersion;
+	learningModelVersion = modelVersion;
+	rebuildInference();
+}
+
+bool UBayesianNetwork::startEMLearning(FString filename, int32 maxIterations, float epsilon, int32 chunkRows, float priorWeight, int32 threads)
+{
+	if (emThread || !FPlatformProcess::SupportsMultithreading())
+		return false;
+
+	if (!FPaths::FileExists(filename)) {
+		UE_LOG(LogTemp, Warning, TEXT("%s: %s not found"), *GetName(), *filename);
+		return false;
+	}
+
+	FBayesianEMSettings settings;
+	TWeakObjectPtr<UBayesianNetwork> weakThis(this);
+
+	emThreads = FInferenceThreadBudget::Acquire(FMath::Max(threads, 1));
+	emModelVersion = modelVersion;
+
+	settings.Filename = filename;
+	settings.MaxIterations = maxIterations;
+	settings.Epsilon = epsilon;
+	settings.ChunkRows = chunkRows;
+	settings.PriorWeight = priorWeight;
+	settings.Threads = emThreads;
+
+	emThread = new FBayesianEMThread(bn, settings,
+		[weakThis](int32 iteration, double logLikelihood) {
+			AsyncTask(ENamedThreads::GameThread, [weakThis, iteration, logLikelihood]() {
+				if (UBayesianNetwork* network = weakThis.Get())
+					network->OnEMIteration.Broadcast(iteration, logLikelihood);
+			});
+		},
+		[weakThis](bool success, double logLikelihood) {
+			AsyncTask(ENamedThreads::GameThread, [weakThis, success, logLikelihood]() {
+				if (UBayesianNetwork* network = weakThis.Get())
+					network->onEMLearningFinished(success, logLikelihood);
+			});
+		});
+	return true;
+}
+
+void UBayesianNetwork::cancelEMLearning()
+{
+	if (emThread)
+		emThread->Stop();
+}
+
+void UBayesianNetwork::onEMLearningFinished(bool success, double logLikelihood)
+{
+	if (!emThread)
+		return;
+
+	emThread->EnsureCompletion();
+
+	if (success && emModelVersion != modelVersion) {
+		UE_LOG(LogTemp, Warning, TEXT("%s: model changed during EM learning, discarding the learned parameters"), *GetName());
+		success = false;
+	}
+
+	if (success) {
+		const std::vector<FBNLearningNode>& layout = emThread->GetLayout();
+		const std::vector<double>& parameters = emThread->GetParameters();
+
+		for (gum::NodeId id : bn.nodes()) {
+			const gum::Potential<double>& cpt = bn.cpt(id);
+			const int32 offset = layout[id].offset;
+
+			cpt.fillWith(std::vector<double>(parameters.begin() + offset, parameters.begin() + offset + cpt.domainSize()));
+		}
+
+		++modelVersion;
+		rebuildInference();
+	}
+
+	delete emThread;
+	emThread = nullptr;
+	FInferenceThreadBudget::Release(emThreads);
+	emThreads = 0;
+
+	OnEMFinished.Broadcast(success, logLikelihood);
+}
+
+void UBayesianNetwork::resetLearning()
+{
+	learningNodes.clear();
+	learningCounts.Empty();
+	learningSamples = 0;
+}
+
+#if WITH_DEV_AUTOMATION_TESTS
+float UBayesianNetwork::benchmarkParameterLearning(int32 samples)
+{
+	FRandomStream random(1234);
+	TArray<int32> data;
+
+	prepareLearning();
+	samples = FMath::Max(samples, 1);
+
+	const int32 n = nodeCache.size();
+	const TArray<float> savedCounts = learningCounts;
+	const int64 savedSamples = learningSamples;
+	const int32 savedInterval = LearningFoldInterval;
+
+	data.SetNumUninitialized(samples * n);
+	for (int32 i = 0; i < samples; i++)
+		for (int32 id = 0; id < n; id++)
+			data[i * n + id] = nodeCache[id].valid ? random.RandRange(0, nodeCache[id].labels.Num() - 1) : -1;
+
+	LearningFoldInterval = 0;
+
+	const double start = FPlatformTime::Seconds();
+	for (int32 i = 0; i < samples; i++)
+		recordSample(TArrayView<const int32>(data.GetData() + i * n, n));
+	const double elapsed = FPlatformTime::Seconds() - start;
+
+	learningCounts = savedCounts;
+	learningSamples = savedSamples;
+	LearningFoldInterval = savedInterval;
+
+	const float rate = elapsed > 0 ? samples / elapsed : 0;
+
+	UE_LOG(LogTemp, Log, TEXT("%s: %d learning samples over %d nodes, %.0f samples/s"), *GetName(), samples, bn.size(), rate);
+	return rate;
+}
+#endif
+
+UBayesianNetworkSession* UBayesianNetwork::createSession(UObject* owner)
+{
+	UBayesianNetworkSession* session = NewObject<UBayesianNetworkSession>(owner ? owner : GetTransientPackage());
+
+	session->setModel(this);
+	return session;
+}
+
+void UBayesianNetwork::makeInferenceAsync(FInferenceCompletedDelegate onCompleted)
+{
+	if (onCompleted.IsBound())
+		queuedCallbacks.Add(onCompleted);
+
+	// A run is in flight: coalesce into one follow-up run with the latest evidence
+	if (asyncPending) {
+		asyncRerun = true;
+		return;
+	}
+
+	launchAsyncInference();
+}
+
+void UBayesianNetwork::launchAsyncInference()
+{
+	if (nodeCacheDirty)
+		rebuildNodeCache();
+
+	// The worker owns a private copy of the model, refreshed only when the model has changed since the last run
+	if (!asyncInference || asyncModelVersion != modelVersion || asyncAlgorithm != InferenceAlgorithm || asyncSinglePrecision != SinglePrecision) {
+		delete asyncInference;
+		asyncBN = bn;
+		asyncInference = createInference(&asyncBN, &asyncScheduler, &asyncApproximation);
+		asyncModelVersion = modelVersion;
+		asyncAlgorithm = InferenceAlgorithm;
+		asyncSinglePrecision = SinglePrecision;
+	}
+
+	TArray<TPair<gum::NodeId, std::vector<double>>> snapshot;
+	TArray<int32> domainSizes;
+
+	for (const auto& evidence : inference->evidence()) {
+		auto& item = snapshot.AddDefaulted_GetRef();
+		item.Key = evidence.first;
+		potentialToVector(*evidence.second, item.Value);
+	}
+
+	domainSizes.SetNumZeroed(nodeCache.size());
+	for (int32 id = 0; id < domainSizes.Num(); id++)
+		if (nodeCache[id].valid)
+			domainSizes[id] = nodeCache[id].labels.Num();
+
+	asyncCallbacks = MoveTemp(queuedCallbacks);
+	queuedCallbacks.Reset();
+	asyncPending = true;
+	asyncWorking = true;
+
+	TWeakObjectPtr<UBayesianNetwork> weakThis(this);
+	const FBNInferenceSettings settings = getInferenceSettings();
+
+	Async(EAsyncExecution::ThreadPool, [this, weakThis, settings, snapshot = MoveTemp(snapshot), domainSizes = MoveTemp(domainSizes)]() {
+		FBNPosteriorBuffer& out = pendingPosteriors;
+		int32 total = 0;
+		bool success = true;
+
+		out.offsets.SetNumUninitialized(domainSizes.Num() + 1, false);
+		for (int32 id = 0; id < domainSizes.Num(); id++) {
+			out.offsets[id] = total;
+			total += domainSizes[id];
+		}
+		out.offsets[domainSizes.Num()] = total;
+		out.values.SetNumZeroed(total, false);
+
+		try {
+			asyncInference->eraseAllEvidence();
+			for (const auto& item : snapshot)
+				asyncInference->addEvidence(item.Key, item.Value);
+			runInference(asyncInference, asyncScheduler, asyncApproximation, &pendingApproximationStats, settings);
+
+			for (int32 id = 0; id < domainSizes.Num(); id++) {
+				if (domainSizes[id] == 0)
+					continue;
+
+				const gum::Potential<double>& result = asyncInference->posterior(id);
+				gum::Instantiation inst(result);
+				int32 j = out.offsets[id];
+
+				for (inst.setFirst(); !inst.end(); inst.inc())
+					out.values[j++] = result.get(inst);
+			}
+		}
+		catch (gum::Exception& e) {
+			UE_LOG(LogTemp, Warning, TEXT("%hs from %hs during asynchronous inference"), e.errorType().c_str(), e.errorContent().c_str());
+			success = false;
+		}
+		catch (std::exception& e) {
+			UE_LOG(LogTemp, Warning, TEXT("%hs during asynchronous inference"), e.what());
+			success = false;
+		}
+		catch (...) {
+			UE_LOG(LogTemp, Warning, TEXT("Unknown exception during asynchronous inference"));
+			success = false;
+		}
+
+		asyncWorking = false;
+
+		AsyncTask(ENamedThreads::GameThread, [weakThis, success]() {
+			if (UBayesianNetwork* network = weakThis.Get())
+				network->onAsyncInferenceCompleted(success);
+		});
+	});
+}
+
+void UBayesianNetwork::onAsyncInferenceCompleted(bool success)
+{
+	// A failed run is dropped, readers keep the last good results
+	if (success) {
+		Swap(completedPosteriors, pendingPosteriors);
+		approximationStats = pendingApproximationStats;
+	}
+	asyncPending = false;
+
+	TArray<FInferenceCompletedDelegate> callbacks = MoveTemp(asyncCallbacks);
+	asyncCallbacks.Reset();
+
+	// Evidence may have changed while the worker was busy
+	if (asyncRerun) {
+		asyncRerun = false;
+		launchAsyncInference();
+	}
+
+	for (FInferenceCompletedDelegate& callback : callbacks)
+		callback.ExecuteIfBound(success);
+}
+
+bool UBayesianNetwork::isInferenceRunning() const
+{
+	return asyncPending;
+}
+
+bool UBayesianNetwork::getCompletedPosterior(const FBNNodeHandle& node, TArrayView<float> out) const
+{
+	if (node.id < 0 || node.id >= completedPosteriors.Num())
+		return false;
+
+	TArrayView<const float> values = completedPosteriors.get(node.id);
+
+	if (values.Num() == 0 || out.Num() < values.Num())
+		return false;
+
+	FMemory::Memcpy(out.GetData(), values.GetData(), values.Num() * sizeof(float));
+	return true;
+}
+
+bool UBayesianNetwork::getCompletedPosteriorByHandle(const FBNNodeHandle& node, TArray<float>& values) const
+{
+	values.SetNumUninitialized(node.domainSize, false);
+	return getCompletedPosterior(node, TArrayView<float>(values));
+}
+
+TMap<FString, float> UBayesianNetwork::getPosterior(FString variable)
+{
+	TMap<FString, float> out;
+	const FBNNodeHandle node = getNodeHandle(variable);
+	TArray<float, TInlineAllocator<32>> values;
+
+	values.SetNumUninitialized(node.domainSize);
+	if (!node.IsValid() || !getPosterior(node, values))
+		return out;
+
+	const TArray<FString>& labels = getLabels(node);
+
+	for (int32 j = 0; j < labels.Num(); j++)
+		out.Add(labels[j], values[j]);
+	
+	return out;
+}
+
+void UBayesianNetwork::writeBIF(FString file)
+{
+	auto writer = gum::BIFWriter<double>();
+	writer.write(TCHAR_TO_UTF8(*file), bn);
+}
+
+void UBayesianNetwork::erase(FString variable)
+{
+	gum::NodeId id;
+
+	try {
+		id = bn.idFromName(TCHAR_TO_UTF8(*variable));
+	}
+	catch (gum::NotFound& e) {
+		UE_LOG(LogTemp, Warning, TEXT("%hs from %hs while erasing"), e.errorType().c_str(), e.errorContent().c_str());
+		return;
+	}
+
+	if (arcIds.Num() != arcs.Num())
+		rebuildArcIndex();
+
+	for (gum::NodeId parent : bn.parents(id))
+		removeArcSlot(parent, id);
+	for (gum::NodeId child : bn.children(id))
+		removeArcSlot(id, child);
+
+	bn.erase(id);
+	if (id < nodeGenerations.size())
+		nodeGenerations[id] = 0;
+	nodeNames.Remove(variable);
+	nodeDescriptions.Remove(variable);
+	nodeCacheDirty = true;
+	compiledOrder.clear();
+	++modelVersion;
+}
+
+void UBayesianNetwork::setBN(const FString& Filename) {
+	gum::BayesNet<double> network;
+	FString error;
+
+	if (!readNetworkFile(Filename, network, error)) {
+		UE_LOG(LogTemp, Warning, TEXT("%s: could not read %s, %s"), *GetName(), *Filename, *error);
+		return;
+	}
+	setBN(network);
+}
+
+template <typename Reader>
+static bool readNetworkWith(const std::string& filename, gum::BayesNet<double>& result, FString& error)
+{
+	Reader reader(&result, filename);
+
+	if (reader.proceed() == 0)
+		return true;
+
+	// The XML readers throw instead of counting errors
+	if constexpr (requires(std::ostream& stream) { reader.showElegantErrors(stream); }) {
+		std::ostringstream stream;
+
+		reader.showElegantErrors(stream);
+		error = FString(stream.str().c_str());
+	}
+	else
+		error = TEXT("parse error");
+	return false;
+}
+
+bool UBayesianNetwork::readNetworkFile(const FString& Filename, gum::BayesNet<double>& result, FString& error)
+{
+	const FString extension = FPaths::GetExtension(Filename).ToLower();
+	const std::string filename(TCHAR_TO_UTF8(*Filename));
+
+	result = gum::BayesNet<double>();
+
+	try {
+		if (extension == TEXT("bif"))
+			return readNetworkWith<gum::BIFReader<double>>(filename, result, error);
+		if (extension == TEXT("uai"))
+			return readNetworkWith<gum::UAIBNReader<double>>(filename, result, error);
+		if (extension == TEXT("net"))
+			return readNetworkWith<gum::NetReader<double>>(filename, result, error);
+		if (extension == TEXT("dsl"))
+			return readNetworkWith<gum::DSLReader<double>>(filename, result, error);
+		if (extension == TEXT("xdsl"))
+			return readNetworkWith<gum::XDSLBNReader<double>>(filename, result, error);
+		if (extension == TEXT("bifxml"))
+			return readNetworkWith<gum::BIFXMLBNReader<double>>(filename, result, error);
+	}
+	catch (gum::Exception& e) {
+		error = FString::Printf(TEXT("%hs from %hs"), e.errorType().c_str(), e.errorContent().c_str());
+		return false;
+	}
+
+	error = FString::Printf(TEXT("unsupported format .%s"), *extension);
+	return false;
+}
+
+bool UBayesianNetwork::isNetworkFileSupported(const FString& Filename)
+{
+	static const TCHAR* extensions[] = { TEXT("bif"), TEXT("uai"), TEXT("net"), TEXT("dsl"), TEXT("xdsl"), TEXT("bifxml") };
+	const FString extension = FPaths::GetExtension(Filename).ToLower();
+
+	for (const TCHAR* supported : extensions)
+		if (extension == supported)
+			return true;
+	return false;
+}
+
+void UBayesianNetwork::setBN(const gum::BayesNet<double>& network)
+{
+	delete inference;
+	inference = nullptr;
+	bn = network;
+	serializedNodes.Empty();
+	onNetworkReplaced();
+}
+
+void UBayesianNetwork::onNetworkReplaced()
+{
+	unsigned int j;
+	FBayesianNodeStruct newNode;
+
+	compileStructure();
+	loadCompiledStructure();
+
+	delete inference;
+	inference = createInference(&bn, &inferenceScheduler, &inferenceApproximation);
+	applyTargets(inference, inferenceScheduler != nullptr);
+	++evidenceVersion;
+
+	nodeNames.Reset();
+	nodeDescriptions.Reset();
+
+	for (int i : bn.nodes()) {
+		gum::Instantiation inst(bn.cpt(i));
+		
+		newNode.variables.Empty();
+		newNode.values.Empty();
+		newNode.parents.Empty();
+		newNode.description = FString(bn.variable(i).description().c_str());
+
+		for (inst.setFirst(), j = 0; !inst.end(); ++inst, j++) {
+			newNode.name = FString(bn.variable(i).name().c_str());
+			if (j < bn.variable(i).domainSize())
+				newNode.variables.Add(FString(bn.variable(i).label(j).c_str()));
+			newNode.values.Add(bn.cpt(i).get(inst));
+		}
+
+		// In CPT order, so that values can be read back by BuildFromDescription
+		for (gum::Idx k = 1; k < bn.cpt(i).nbrDim(); k++)
+			newNode.parents.Add(FString(bn.cpt(i).variable(k).name().c_str()));
+
+		serializedNodes.Add(newNode);
+		nodeNames.Add(newNode.name);
+		nodeDescriptions.Add(newNode.name, newNode.description);
+	}
+	rebuildArcIndex();
+	nodeCacheDirty = true;
+	nodeGenerations.clear();
+	++modelVersion;
+	cookNetwork();
+	initialized = true;
+}
+
+void UBayesianNetwork::addLabelizedVariable(FString variable, FString description, TArray<FString> labels) {
+	if (!nodeNames.Contains(variable))
+	{
+		gum::LabelizedVariable newNode(TCHAR_TO_UTF8(*variable), TCHAR_TO_UTF8(*description), 0);
+
+		for (const FString& label : labels)
+			newNode.addLabel(TCHAR_TO_UTF8(*label));
+
+		try {
+			bn.add(newNode);
+		}
+		catch (gum::Exception& e) {
+			UE_LOG(LogTemp, Warning, TEXT("%hs from %hs while adding %s"), e.errorType().c_str(), e.errorContent().c_str(), *variable);
+			return;
+		}
+		nodeNames.Add(variable);
+		nodeDescriptions.Add(variable, description);
+		nodeCacheDirty = true;
+		compiledOrder.clear();
+		++modelVersion;
+	}
+}
+
+void UBayesianNetwork::addDiscretizedVariable(FString variable, FString description, float minTick, float maxTick, float nPoints, BayesianNodeType nodeType) {
+	if (!nodeNames.Contains(variable))
+	{
+		gum::DiscretizedVariable<float> newNode(TCHAR_TO_UTF8(*variable), TCHAR_TO_UTF8(*description));
+		std::vector<float> ticks = myLinspace(minTick, maxTick, nPoints);
+
+		for (float i : ticks)
+			newNode.addTick(i);
+
+		switch (nodeType) {
+		case BayesianNodeType::NORMAL: bn.add(newNode); break;
+		case BayesianNodeType::AMPLITUDE: bn.addAMPLITUDE(newNode); break;
+		case BayesianNodeType::AND: bn.addAND(newNode); break;
+		case BayesianNodeType::COUNT: bn.addCOUNT(newNode); break;
+		case BayesianNodeType::EXISTS: bn.addEXISTS(newNode); break;
+		case BayesianNodeType::FORALL: bn.addFORALL(newNode); break;
+		case BayesianNodeType::MAX: bn.addMAX(newNode); break;
+		case BayesianNodeType::MEDIAN: bn.addMEDIAN(newNode); break;
+		case BayesianNodeType::MIN: bn.addMIN(newNode); break;
+		}
+		nodeNames.Add(variable);
+		nodeDescriptions.Add(variable, description);
+		nodeCacheDirty = true;
+		compiledOrder.clear();
+		++modelVersion;
+	}
+}
+
+void UBayesianNetwork::addArc(FString parent, FString child) {
+	try {
+		const gum::NodeId tail = bn.idFromName(TCHAR_TO_UTF8(*parent));
+		const gum::NodeId head = bn.idFromName(TCHAR_TO_UTF8(*child));
+
+		if (bn.existsArc(tail, head))
+			return;
+
+		if (arcIds.Num() != arcs.Num())
+			rebuildArcIndex();
+
+		bn.addArc(tail, head);
+		arcSlots.Add(TPair<gum::NodeId, gum::NodeId>(tail, head), arcs.Num());
+		arcIds.Emplace(tail, head);
+		arcs.Add(parent + "_" + child);
+		compiledOrder.clear();
+		++modelVersion;
+	}
+	catch (gum::Exception& e)
+		UE_LOG(LogTemp, Warning, TEXT("%hs from %hs while adding arc"), e.errorType().c_str(), e.errorContent().c_str());
+}
+
+void UBayesianNetwork::rebuildArcIndex()
+{
+	arcs.Reset();
+	arcIds.Reset();
+	arcSlots.Reset();
+
+	for (const gum::Arc& arc : bn.arcs()) {
+		arcSlots.Add(TPair<gum::NodeId, gum::NodeId>(arc.tail(), arc.head()), arcs.Num());
+		arcIds.Emplace(arc.tail(), arc.head());
+		arcs.Add(FString(bn.variable(arc.tail()).name().c_str()) + "_" + FString(bn.variable(arc.head()).name().c_str()));
+	}
+}
+
+void UBayesianNetwork::removeArcSlot(gum::NodeId tail, gum::NodeId head)
+{
+	int32 slot;
+
+	if (!arcSlots.RemoveAndCopyValue(TPair<gum::NodeId, gum::NodeId>(tail, head), slot))
+		return;
+
+	// The last arc takes the freed slot
+	arcs.RemoveAtSwap(slot);
+	arcIds.RemoveAtSwap(slot);
+	if (slot < arcIds.Num())
+		arcSlots[arcIds[slot]] = slot;
+}
+
+bool UBayesianNetwork::BuildFromDescription(const TArray<FBayesianNodeStruct>& nodes)
+{
+	gum::BayesNet<double> network;
+	TMap<FString, int32> indices;
+	TArray<gum::NodeId> ids;
+	TArray<TArray<int32>> parents;
+	TArray<TArray<int32>> children;
+	TArray<int32> pending;
+	TArray<int32> order;
+
+	indices.Reserve(nodes.Num());
+	ids.Reserve(nodes.Num());
+	parents.SetNum(nodes.Num());
+	children.SetNum(nodes.Num());
+	pending.SetNumZeroed(nodes.Num());
+	order.Reserve(nodes.Num());
+
+	try {
+		for (const FBayesianNodeStruct& node : nodes) {
+			if (indices.Contains(node.name)) {
+				UE_LOG(LogTemp, Warning, TEXT("%s: node %s is described twice"), *GetName(), *node.name);
+				return false;
+			}
+			if (node.variables.Num() == 0) {
+				UE_LOG(LogTemp, Warning, TEXT("%s: node %s has no labels"), *GetName(), *node.name);
+				return false;
+			}
+
+			gum::LabelizedVariable variable(TCHAR_TO_UTF8(*node.name), TCHAR_TO_UTF8(*node.description), 0);
+
+			for (const FString& label : node.variables)
+				variable.addLabel(TCHAR_TO_UTF8(*label));
+			indices.Add(node.name, ids.Num());
+			ids.Add(network.add(variable));
+		}
+
+		for (int32 i = 0; i < nodes.Num(); i++) {
+			for (const FString& parent : nodes[i].parents) {
+				const int32* tail = indices.Find(parent);
+
+				if (!tail) {
+					UE_LOG(LogTemp, Warning, TEXT("%s: parent %s of %s is not described"), *GetName(), *parent, *nodes[i].name);
+					return false;
+				}
+				parents[i].Add(*tail);
+				children[*tail].Add(i);
+				pending[i]++;
+			}
+		}
+
+		// Kahn's algorithm: a node comes once all of its parents are placed, whatever is left over lies on a cycle
+		for (int32 i = 0; i < nodes.Num(); i++)
+			if (pending[i] == 0)
+				order.Add(i);
+		for (int32 k = 0; k < order.Num(); k++)
+			for (int32 child : children[order[k]])
+				if (--pending[child] == 0)
+					order.Add(child);
+
+		if (order.Num() < nodes.Num()) {
+			UE_LOG(LogTemp, Warning, TEXT("%s: the parents of the description form a directed cycle"), *GetName());
+			return false;
+		}
+
+		// In topological order a node has no children yet when its arcs are added, so the DAG's cycle check stops
+		// at once. Arcs follow the order of parents, which is also the variable order of the CPT, and the CPTs are
+		// resized once at the end
+		network.beginTopologyTransformation();
+		for (int32 i : order)
+			for (int32 parent : parents[i])
+				network.addArc(ids[parent], ids[i]);
+		network.endTopologyTransformation();
+
+		for (int32 i = 0; i < nodes.Num(); i++) {
+			const FBayesianNodeStruct& node = nodes[i];
+			const gum::Potential<double>& cpt = network.cpt(ids[i]);
+
+			if (node.values.Num() == 0) {
+				cpt.fillWith(1.0 / node.variables.Num());
+				continue;
+			}
+
+			if (node.values.Num() != (int32)cpt.domainSize()) {
+				UE_LOG(LogTemp, Warning, TEXT("%s: CPT of %s has %d values, %d expected"), *GetName(), *node.name, node.values.Num(), (int32)cpt.domainSize());
+				return false;
+			}
+			cpt.fillWith(std::vector<double>(node.values.GetData(), node.values.GetData() + node.values.Num()));
+		}
+	}
+	catch (gum::Exception& e) {
+		UE_LOG(LogTemp, Warning, TEXT("%hs from %hs while building the network"), e.errorType().c_str(), e.errorContent().c_str());
+		return false;
+	}
+
+	setBN(network);
+	return true;
+}
+
+int UBayesianNetwork::idFromName(FString variable) {
+	return bn.idFromName(TCHAR_TO_UTF8(*variable));
+}
+
+void UBayesianNetwork::fillWith(FString variable, float value) {
+	try {
+		bn.cpt(TCHAR_TO_UTF8(*variable)).fillWith(value);
+		++modelVersion;
+		rebuildInference();
+	}
+	catch (gum::NotFound& e)
+		UE_LOG(LogTemp, Warning, TEXT("%hs from %hs while filling"), e.errorType().c_str(), e.errorContent().c_str());
+}
+
+void UBayesianNetwork::addEvidence(FString variable, TArray<float> data)
+{
+	const FBNNodeHandle node = getNodeHandle(variable);
+
+	if (node.IsValid())
+		addEvidence(node, TArrayView<const float>(data));
+
+	/*if (variable == "109064338") {
+		for (float v : vec) {
+			UE_LOG(LogTemp, Warning, TEXT("%hs"), TCHAR_TO_UTF8(*variable));
+			UE_LOG(LogTemp, Warning, TEXT("%hf"), v);
+			inference->makeInference();
+			UE_LOG(LogTemp, Warning, TEXT("%hg"), inference->H(var));
+		}
+	}*/
+}
+
+TArray<FString> UBayesianNetwork::getMarkovBlanketNodes(FString variable) {
+	gum::MarkovBlanket markovBlanket = gum::MarkovBlanket(bn, TCHAR_TO_UTF8(*variable));
+
+	TArray<FString> markovBlaketNodes;
+
+	for (auto node : markovBlanket.nodes())
+		markovBlaketNodes.Add(bn.variable(node).name().c_str());
+
+	return markovBlaketNodes;
+}
+
+void UBayesianNetwork::eraseAllEvidence()
+{
+	if (evidenceUpdateDepth > 0) {
+		stagedEvidence.Reset();
+		stagedEraseAll = true;
+		return;
+	}
+
+	inference->eraseAllEvidence();
+	++evidenceVersion;
+}
+
+void UBayesianNetwork::eraseEvidence(FString variable)
+{
+	const FBNNodeHandle node = getNodeHandle(variable);
+
+	if (node.IsValid())
+		eraseEvidence(node);
+}
+
+double UBayesianNetwork::getEntropy(FString variable)
+{
+	if (!variable.IsEmpty()) {
+		ensureInference();
+		return (float) inference->H(TCHAR_TO_UTF8(*variable));
+	}
+	return 0;
+}
+
+
+void UBayesianNetwork::rebuildNodeCache()
+{
+	gum::NodeId maxId = 0;
+
+	for (gum::NodeId id : bn.nodes())
+		maxId = FMath::Max(maxId, id + 1);
+
+	nodeCache.clear();
+	nodeCache.resize(maxId);
+	nodeGenerations.resize(maxId, 0);
+	nodeIndex.Empty(bn.size());
+	posteriorOffsets.SetNumZeroed(maxId);
+	posteriorSize = 0;
+
+	for (gum::NodeId id : bn.nodes()) {
+		const gum::DiscreteVariable& var = bn.variable(id);
+		FBNNodeCache& cache = nodeCache[id];
+
+		cache.labels.Reserve(var.domainSize());
+		for (gum::Idx j = 0; j < var.domainSize(); j++)
+			cache.labels.Add(FString(var.label(j).c_str()));
+
+		cache.inst.add(var);
+		cache.evidence.resize(var.domainSize());
+		cache.valid = true;
+		if (nodeGenerations[id] == 0)
+			nodeGenerations[id] = ++lastNodeGeneration;
+		cache.generation = nodeGenerations[id];
+
+		nodeIndex.Add(FString(var.name().c_str()), id);
+		posteriorOffsets[id] = posteriorSize;
+		posteriorSize += var.domainSize();
+	}
+	nodeCacheDirty = false;
+}
+
+FBNNodeCache* UBayesianNetwork::findNodeCache(const FBNNodeHandle& node)
+{
+	if (nodeCacheDirty)
+		rebuildNodeCache();
+
+	if (node.id < 0 || node.id >= (int32)nodeCache.size() || !nodeCache[node.id].valid || nodeCache[node.id].generation != node.generation)
+		return nullptr;
+	return &nodeCache[node.id];
+}
+
+FBNNodeHandle UBayesianNetwork::getNodeHandle(FString variable)
+{
+	FBNNodeHandle node;
+
+	if (nodeCacheDirty)
+		rebuildNodeCache();
+
+	if (const int32* id = nodeIndex.Find(variable)) {
+		node.id = *id;
+		node.domainSize = nodeCache[*id].labels.Num();
+		node.generation = nodeCache[*id].generation;
+	}
+	else
+		UE_LOG(LogTemp, Warning, TEXT("Node %s not found in Bayesian network"), *variable);
+
+	return node;
+}
+
+bool UBayesianNetwork::addEvidence(const FBNNodeHandle& node, TArrayView<const float> data)
+{
+	FBNNodeCache* cache = findNodeCache(node);
+
+	if (!cache || data.Num() != cache->labels.Num())
+		return false;
+
+	for (int32 j = 0; j < data.Num(); j++)
+		cache->evidence[j] = data[j];
+
+	if (evidenceUpdateDepth > 0) {
+		stagedEvidence.Add(node.id, false);
+		return true;
+	}
+
+	if (!applyEvidence(node.id, cache->evidence))
+		return false;
+	++evidenceVersion;
+	return true;
+}
+
+bool UBayesianNetwork::applyEvidence(gum::NodeId id, const std::vector<double>& values)
+{
+	// chgEvidence updates the stored potential in place and only invalidates the junction tree on a hard/soft switch
+	try {
+		if (inference->hasEvidence(id))
+			inference->chgEvidence(id, values);
+		else
+			inference->addEvidence(id, values);
+	}
+	catch (gum::Exception& e) {
+		UE_LOG(LogTemp, Warning, TEXT("%hs from %hs while adding evidence"), e.errorType().c_str(), e.errorContent().c_str());
+		return false;
+	}
+	return true;
+}
+
+void UBayesianNetwork::eraseEvidence(const FBNNodeHandle& node)
+{
+	if (!findNodeCache(node))
+		return;
+
+	if (evidenceUpdateDepth > 0) {
+		stagedEvidence.Add(node.id, true);
+		return;
+	}
+
+	if (inference->hasEvidence(node.id)) {
+		inference->eraseEvidence(node.id);
+		++evidenceVersion;
+	}
+}
+
+void UBayesianNetwork::beginEvidenceUpdate()
+{
+	++evidenceUpdateDepth;
+}
+
+void UBayesianNetwork::commitEvidenceUpdate()
+{
+	if (evidenceUpdateDepth == 0) {
+		UE_LOG(LogTemp, Warning, TEXT("%s: commitEvidenceUpdate without beginEvidenceUpdate"), *GetName());
+		return;
+	}
+
+	if (--evidenceUpdateDepth > 0)
+		return;
+
+	bool changed = false;
+
+	if (stagedEraseAll) {
+		std::vector<gum::NodeId> erased;
+
+		// Nodes set again in the same update keep their potential and are changed in place below
+		for (const auto& item : inference->evidence())
+			if (!stagedEvidence.Contains(item.first))
+				erased.push_back(item.first);
+		for (gum::NodeId id : erased)
+			inference->eraseEvidence(id);
+		changed = true;
+	}
+
+	if (nodeCacheDirty)
+		rebuildNodeCache();
+
+	for (const TPair<int32, bool>& item : stagedEvidence) {
+		if (item.Key >= (int32)nodeCache.size() || !nodeCache[item.Key].valid)
+			continue;
+
+		if (item.Value) {
+			if (inference->hasEvidence(item.Key)) {
+				inference->eraseEvidence(item.Key);
+				changed = true;
+			}
+		}
+		else
+			changed |= applyEvidence(item.Key, nodeCache[item.Key].evidence);
+	}
+
+	stagedEvidence.Reset();
+	stagedEraseAll = false;
+
+	if (changed)
+		++evidenceVersion;
+}
+
+bool UBayesianNetwork::setEvidenceBatch(const TArray<FBNEvidenceItem>& evidence)
+{
+	bool ok = true;
+
+	beginEvidenceUpdate();
+	for (const FBNEvidenceItem& item : evidence) {
+		const FBNNodeHandle node = getNodeHandle(item.variable);
+
+		ok &= node.IsValid() && addEvidence(node, TArrayView<const float>(item.values));
+	}
+	commitEvidenceUpdate();
+	return ok;
+}
+
+bool UBayesianNetwork::getPosterior(const FBNNodeHandle& node, TArrayView<float> out)
+{
+	FBNNodeCache* cache = findNodeCache(node);
+
+	if (!cache || out.Num() < cache->labels.Num())
+		return false;
+
+	FBNPosteriorCacheEntry* entry = nullptr;
+	const int32 domainSize = cache->labels.Num();
+
+	if (UsePosteriorCache) {
+		bool isNew;
+		entry = findPosteriorCacheEntry(isNew);
+
+		if (entry && entry->present[node.id]) {
+			FMemory::Memcpy(out.GetData(), entry->values.GetData() + posteriorOffsets[node.id], domainSize * sizeof(float));
+			++posteriorCacheHits;
+			return true;
+		}
+		if (entry)
+			++posteriorCacheMisses;
+	}
+
+	try {
+		ensureInference();
+		const gum::Potential<double>& result = inference->posterior(node.id);
+		int32 j;
+
+		for (cache->inst.setFirst(), j = 0; !cache->inst.end(); cache->inst.inc(), ++j)
+			out[j] = result.get(cache->inst);
+	}
+	catch (gum::Exception& e) {
+		UE_LOG(LogTemp, Warning, TEXT("%hs from %hs"), e.errorType().c_str(), e.errorContent().c_str());
+		return false;
+	}
+
+	if (entry) {
+		FMemory::Memcpy(entry->values.GetData() + posteriorOffsets[node.id], out.GetData(), domainSize * sizeof(float));
+		entry->present[node.id] = true;
+	}
+	return true;
+}
+
+double UBayesianNetwork::getEntropy(const FBNNodeHandle& node)
+{
+	if (!findNodeCache(node))
+		return 0;
+
+	try {
+		ensureInference();
+		return inference->H(node.id);
+	}
+	catch (gum::Exception& e)
+		UE_LOG(LogTemp, Warning, TEXT("%hs from %hs"), e.errorType().c_str(), e.errorContent().c_str());
+	return 0;
+}
+
+void UBayesianNetwork::fillWith(const FBNNodeHandle& node, float value)
+{
+	if (findNodeCache(node)) {
+		bn.cpt(node.id).fillWith(value);
+		++modelVersion;
+		rebuildInference();
+	}
+}
+
+const TArray<FString>& UBayesianNetwork::getLabels(const FBNNodeHandle& node)
+{
+	static const TArray<FString> empty;
+	const FBNNodeCache* cache = findNodeCache(node);
+
+	return cache ? cache->labels : empty;
+}
+
+bool UBayesianNetwork::getPosteriors(TArrayView<const FBNNodeHandle> nodes, FBNPosteriorBuffer& out)
+{
+	int32 total = 0;
+	bool ok = true;
+
+	// Buffers only grow, so reading the same set of nodes every turn does not reallocate
+	out.offsets.SetNumUninitialized(nodes.Num() + 1, false);
+	for (int32 i = 0; i < nodes.Num(); i++) {
+		out.offsets[i] = total;
+		total += FMath::Max(nodes[i].domainSize, 0);
+	}
+	out.offsets[nodes.Num()] = total;
+	out.values.SetNumUninitialized(total, false);
+
+	for (int32 i = 0; i < nodes.Num(); i++) {
+		TArrayView<float> slice(out.values.GetData() + out.offsets[i], out.offsets[i + 1] - out.offsets[i]);
+
+		if (!getPosterior(nodes[i], slice)) {
+			for (float& value : slice)
+				value = 0;
+			ok = false;
+		}
+	}
+	return ok;
+}
+
+void UBayesianNetwork::addEvidenceByHandle(const FBNNodeHandle& node, const TArray<float>& data)
+{
+	addEvidence(node, TArrayView<const float>(data));
+}
+
+void UBayesianNetwork::eraseEvidenceByHandle(const FBNNodeHandle& node)
+{
+	eraseEvidence(node);
+}
+
+bool UBayesianNetwork::getPosteriorByHandle(const FBNNodeHandle& node, TArray<float>& values)
+{
+	values.SetNumUninitialized(node.domainSize, false);
+	return getPosterior(node, TArrayView<float>(values));
+}
+
+double UBayesianNetwork::getEntropyByHandle(const FBNNodeHandle& node)
+{
+	return getEntropy(node);
+}
+
+void UBayesianNetwork::fillWithByHandle(const FBNNodeHandle& node, float value)
+{
+	fillWith(node, value);
+}
+
+TArray<FString> UBayesianNetwork::getLabelsByHandle(const FBNNodeHandle& node)
+{
+	return getLabels(node);
+}
+
+TArray<FBNNodeHandle> UBayesianNetwork::getAllNodeHandles()
+{
+	TArray<FBNNodeHandle> out;
+
+	if (nodeCacheDirty)
+		rebuildNodeCache();
+
+	out.Reserve(nodeIndex.Num());
+	for (int32 id = 0; id < (int32)nodeCache.size(); id++) {
+		if (nodeCache[id].valid) {
+			FBNNodeHandle& node = out.AddDefaulted_GetRef();
+			node.id = id;
+			node.domainSize = nodeCache[id].labels.Num();
+			node.generation = nodeCache[id].generation;
+		}
+	}
+	return out;
+}
+
+bool UBayesianNetwork::getPosteriorsByHandle(const TArray<FBNNodeHandle>& nodes, FBNPosteriorBuffer& result)
+{
+	return getPosteriors(nodes, result);
+}
+
+bool UBayesianNetwork::getPosteriorsByName(const TArray<FString>& variables, FBNPosteriorBuffer& result)
+{
+	TArray<FBNNodeHandle, TInlineAllocator<64>> nodes;
+
+	for (const FString& variable : variables)
+		nodes.Add(getNodeHandle(variable));
+
+	return getPosteriors(nodes, result);
+}
+
+SIZE_T FBNPosteriorCacheEntry::GetAllocatedSize() const
+{
+	return key.GetAllocatedSize() + values.GetAllocatedSize() + present.GetAllocatedSize();
+}
+
+FBNPosteriorCacheEntry* UBayesianNetwork::findPosteriorCacheEntry(bool& isNew)
+{
+	isNew = false;
+
+	if (PosteriorCacheMaxKB <= 0) {
+		clearPosteriorCache();
+		return nullptr;
+	}
+
+	if (nodeCacheDirty)
+		rebuildNodeCache();
+
+	if (posteriorCacheModelVersion != modelVersion) {
+		clearPosteriorCache();
+		posteriorCacheModelVersion = modelVersion;
+	}
+
+	// Canonical key: evidence nodes in id order, each followed by its (hard or soft) likelihood vector
+	if (posteriorCacheEvidenceVersion != evidenceVersion) {
+		TArray<gum::NodeId, TInlineAllocator<64>> ids;
+		std::vector<double> values;
+
+		for (const auto& evidence : inference->evidence())
+			ids.Add(evidence.first);
+		ids.Sort();
+
+		evidenceKey.Reset();
+		for (gum::NodeId id : ids) {
+			potentialToVector(*inference->evidence()[id], values);
+			evidenceKey.Add((double)id);
+			evidenceKey.Append(values.data(), (int32)values.size());
+		}
+
+		evidenceKeyHash = FCrc::MemCrc32(evidenceKey.GetData(), evidenceKey.Num() * sizeof(double));
+		posteriorCacheEvidenceVersion = evidenceVersion;
+	}
+
+	const int64 maxBytes = (int64)PosteriorCacheMaxKB * 1024;
+	FBNPosteriorCacheEntry* entry = posteriorCache.Find(evidenceKeyHash);
+
+	// Hash collision with a different configuration: the newer one takes the slot
+	if (entry && entry->key != evidenceKey) {
+		unlinkPosteriorCacheEntry(evidenceKeyHash, *entry);
+		posteriorCacheBytes -= entry->GetAllocatedSize();
+		posteriorCache.Remove(evidenceKeyHash);
+		entry = nullptr;
+	}
+
+	if (entry) {
+		unlinkPosteriorCacheEntry(evidenceKeyHash, *entry);
+		linkPosteriorCacheEntry(evidenceKeyHash, *entry);
+		return entry;
+	}
+
+	FBNPosteriorCacheEntry newEntry;
+
+	newEntry.key = evidenceKey;
+	newEntry.values.SetNumUninitialized(posteriorSize);
+	newEntry.present.Init(false, posteriorOffsets.Num());
+
+	const int64 entryBytes = newEntry.GetAllocatedSize();
+
+	if (entryBytes > maxBytes)
+		return nullptr;
+
+	// Least recently used entries go first
+	while (posteriorCache.Num() > 0 && posteriorCacheBytes + entryBytes > maxBytes) {
+		const uint32 oldest = posteriorCacheOldest;
+		FBNPosteriorCacheEntry& evicted = posteriorCache[oldest];
+
+		unlinkPosteriorCacheEntry(oldest, evicted);
+		posteriorCacheBytes -= evicted.GetAllocatedSize();
+		posteriorCache.Remove(oldest);
+	}
+
+	posteriorCacheBytes += entryBytes;
+	entry = &posteriorCache.Add(evidenceKeyHash, MoveTemp(newEntry));
+	linkPosteriorCacheEntry(evidenceKeyHash, *entry);
+	isNew = true;
+	return entry;
+}
+
+void UBayesianNetwork::unlinkPosteriorCacheEntry(uint32 key, FBNPosteriorCacheEntry& entry)
+{
+	if (posteriorCache.Num() == 1)
+		return;
+
+	if (key == posteriorCacheNewest)
+		posteriorCacheNewest = entry.older;
+	else
+		posteriorCache[entry.newer].older = entry.older;
+
+	if (key == posteriorCacheOldest)
+		posteriorCacheOldest = entry.newer;
+	else
+		posteriorCache[entry.older].newer = entry.newer;
+}
+
+// Called with entry already in the map and out of the list
+void UBayesianNetwork::linkPosteriorCacheEntry(uint32 key, FBNPosteriorCacheEntry& entry)
+{
+	if (posteriorCache.Num() == 1) {
+		posteriorCacheNewest = key;
+		posteriorCacheOldest = key;
+		return;
+	}
+
+	entry.older = posteriorCacheNewest;
+	posteriorCache[posteriorCacheNewest].newer = key;
+	posteriorCacheNewest = key;
+}
+
+void UBayesianNetwork::clearPosteriorCache()
+{
+	posteriorCache.Empty();
+	posteriorCacheBytes = 0;
+}
+
+FBNPosteriorCacheStats UBayesianNetwork::getPosteriorCacheStats() const
+{
+	FBNPosteriorCacheStats stats;
+
+	stats.hits = posteriorCacheHits;
+	stats.misses = posteriorCacheMisses;
+	stats.entries = posteriorCache.Num();
+	stats.bytes = posteriorCacheBytes;
+	return stats;
+}
+
+void UBayesianNetwork::resetPosteriorCacheStats()
+{
+	posteriorCacheHits = 0;
+	posteriorCacheMisses = 0;
+}
+
+FBNApproximationStats UBayesianNetwork::getApproximationStats() const
+{
+	return approximationStats;
+}
+
+bool UBayesianNetwork::startAnytimeInference()
+{
+	bool gibbs;
+
+	switch (InferenceAlgorithm) {
+	case InferenceAlgs::GibbsSampling:
+	case InferenceAlgs::LoopyGibbsSampling:
+		gibbs = true;
+		break;
+	case InferenceAlgs::ImportanceSampling:
+	case InferenceAlgs::WeightedSampling:
+	case InferenceAlgs::MonteCarloSampling:
+	case InferenceAlgs::LoopyImportanceSampling:
+	case InferenceAlgs::LoopyWeightedSampling:
+	case InferenceAlgs::LoopyMonteCarloSampling:
+		gibbs = false;
+		break;
+	default:
+		UE_LOG(LogTemp, Warning, TEXT("%s: anytime inference needs a sampling algorithm"), *GetName());
+		return false;
+	}
+
+	std::vector<std::pair<gum::NodeId, std::vector<double>>> evidence;
+
+	try {
+		for (const auto& item : inference->evidence()) {
+			evidence.emplace_back(item.first, std::vector<double>());
+			potentialToVector(*item.second, evidence.back().second);
+		}
+		anytimeSampler.init(bn, evidence, gibbs, AnytimeBurnIn, (uint32)FMath::Rand());
+	}
+	catch (gum::Exception& e) {
+		UE_LOG(LogTemp, Warning, TEXT("%hs from %hs while starting anytime inference"), e.errorType().c_str(), e.errorContent().c_str());
+		return false;
+	}
+
+	// Laid out by ascending node id like the sampler, erased ids get an empty range
+	anytimePosteriors.offsets = TArray<int32>(anytimeSampler.offsets.data(), (int32)anytimeSampler.offsets.size());
+	anytimePosteriors.values.SetNumZeroed((int32)anytimeSampler.estimates.size());
+	anytimeSamples = 0;
+	anytimeErrorBound = 1;
+	anytimeModelVersion = modelVersion;
+	anytimeRunning = true;
+	return true;
+}
+
+void UBayesianNetwork::stopAnytimeInference()
+{
+	anytimeRunning = false;
+}
+
+void UBayesianNetwork::Tick(float DeltaTime)
+{
+	if (anytimeRunning)
+		runAnytimeSlice();
+}
+
+void UBayesianNetwork::runAnytimeSlice()
+{
+	// The sampler and the estimates are laid out for the network it started on
+	if (anytimeModelVersion != modelVersion) {
+		UE_LOG(LogTemp, Warning, TEXT("%s: the network changed, anytime inference stopped"), *GetName());
+		stopAnytimeInference();
+		return;
+	}
+
+	try {
+		anytimeSampler.runSlice(FMath::Max(AnytimeIterationsPerTick, 1), FMath::Max(AnytimeMillisecondsPerTick, 0.1f) / 1000.0);
+	}
+	catch (gum::Exception& e) {
+		UE_LOG(LogTemp, Warning, TEXT("%hs from %hs during anytime inference"), e.errorType().c_str(), e.errorContent().c_str());
+		finishAnytimeInference();
+		return;
+	}
+
+	for (int32 j = 0; j < anytimePosteriors.values.Num(); j++)
+		anytimePosteriors.values[j] = (float)anytimeSampler.estimates[j];
+
+	anytimeSamples = anytimeSampler.samples();
+	anytimeErrorBound = (float)anytimeSampler.errorBound();
+
+	const bool finished = anytimeErrorBound <= AnytimeTargetError || anytimeSamples >= ApproxMaxIterations;
+
+	if (finished)
+		finishAnytimeInference();
+	else
+		OnAnytimeProgress.Broadcast(anytimeErrorBound, anytimeSamples, false);
+}
+
+void UBayesianNetwork::finishAnytimeInference()
+{
+	stopAnytimeInference();
+	OnAnytimeProgress.Broadcast(anytimeErrorBound, anytimeSamples, true);
+}
+
+bool UBayesianNetwork::getAnytimePosterior(const FBNNodeHandle& node, TArrayView<float> out) const
+{
+	if (node.id < 0 || node.id >= anytimePosteriors.Num())
+		return false;
+
+	TArrayView<const float> values = anytimePosteriors.get(node.id);
+
+	if (values.Num() == 0 || out.Num() < values.Num())
+		return false;
+
+	FMemory::Memcpy(out.GetData(), values.GetData(), values.Num() * sizeof(float));
+	return true;
+}
+
+bool UBayesianNetwork::getAnytimePosteriorByHandle(const FBNNodeHandle& node, TArray<float>& values) const
+{
+	values.SetNumUninitialized(node.domainSize, false);
+	return getAnytimePosterior(node, TArrayView<float>(values));
+}
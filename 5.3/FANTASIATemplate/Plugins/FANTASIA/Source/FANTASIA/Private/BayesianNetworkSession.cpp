@@ -0,0 +1,222 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "BayesianNetworkSession.h"
+#include <algorithm>
+
+
+UBayesianNetworkSession::UBayesianNetworkSession(const FObjectInitializer& ObjectInitializer)
+: Super(ObjectInitializer)
+{
+}
+
+void UBayesianNetworkSession::BeginDestroy()
+{
+	delete inference;
+	inference = nullptr;
+	Super::BeginDestroy();
+}
+
+void UBayesianNetworkSession::setModel(UBayesianNetwork* network)
+{
+	if (model == network)
+		return;
+
+	delete inference;
+	inference = nullptr;
+	evidence.clear();
+	model = network;
+}
+
+bool UBayesianNetworkSession::refreshInference()
+{
+	if (!model)
+		return false;
+
+	if (inference && modelVersion == model->modelVersion)
+		return true;
+
+	// The engine is built lazily and only again when the shared model has been edited. The other exact engines keep
+	// tables of their own, which would multiply memory by the number of sessions
+	delete inference;
+	inference = model->createInference(&model->bn, &inferenceScheduler, &inferenceApproximation, InferenceAlgs::Lazy_Propagation);
+	modelVersion = model->modelVersion;
+
+	for (auto it = evidence.begin(); it != evidence.end();) {
+		if (!model->bn.exists(it->first) || model->bn.variable(it->first).domainSize() != it->second.size()) {
+			it = evidence.erase(it);
+			continue;
+		}
+
+		try {
+			inference->addEvidence(it->first, it->second);
+			++it;
+		}
+		catch (gum::Exception& e) {
+			UE_LOG(LogTemp, Warning, TEXT("%hs from %hs while restoring session evidence"), e.errorType().c_str(), e.errorContent().c_str());
+			it = evidence.erase(it);
+		}
+	}
+	return true;
+}
+
+void UBayesianNetworkSession::makeInference()
+{
+	if (!refreshInference())
+		return;
+
+	try {
+		model->runInference(inference, inferenceScheduler, inferenceApproximation, nullptr);
+	}
+	catch (gum::Exception& e)
+		UE_LOG(LogTemp, Warning, TEXT("%hs from %hs"), e.errorType().c_str(), e.errorContent().c_str());
+}
+
+bool UBayesianNetworkSession::addEvidence(const FBNNodeHandle& node, TArrayView<const float> data)
+{
+	if (!refreshInference())
+		return false;
+
+	const FBNNodeCache* cache = model->findNodeCache(node);
+
+	if (!cache || data.Num() != cache->labels.Num())
+		return false;
+
+	auto it = std::find_if(evidence.begin(), evidence.end(), [&](const auto& item) { return item.first == (gum::NodeId)node.id; });
+
+	if (it == evidence.end())
+		it = evidence.emplace(evidence.end(), node.id, std::vector<double>());
+
+	it->second.assign(data.begin(), data.end());
+
+	try {
+		if (inference->hasEvidence(node.id))
+			inference->eraseEvidence(node.id);
+		inference->addEvidence(node.id, it->second);
+	}
+	catch (gum::Exception& e) {
+		UE_LOG(LogTemp, Warning, TEXT("%hs from %hs while adding evidence"), e.errorType().c_str(), e.errorContent().c_str());
+		evidence.erase(it);
+		return false;
+	}
+	return true;
+}
+
+void UBayesianNetworkSession::eraseEvidence(const FBNNodeHandle& node)
+{
+	auto it = std::find_if(evidence.begin(), evidence.end(), [&](const auto& item) { return item.first == (gum::NodeId)node.id; });
+
+	if (it == evidence.end())
+		return;
+
+	evidence.erase(it);
+	if (inference && inference->hasEvidence(node.id))
+		inference->eraseEvidence(node.id);
+}
+
+void UBayesianNetworkSession::eraseAllEvidence()
+{
+	evidence.clear();
+	if (inference)
+		inference->eraseAllEvidence();
+}
+
+bool UBayesianNetworkSession::getPosterior(const FBNNodeHandle& node, TArrayView<float> out)
+{
+	if (!refreshInference())
+		return false;
+
+	FBNNodeCache* cache = model->findNodeCache(node);
+
+	if (!cache || out.Num() < cache->labels.Num())
+		return false;
+
+	try {
+		const gum::Potential<double>& result = inference->posterior(node.id);
+		int32 j;
+
+		for (cache->inst.setFirst(), j = 0; !cache->inst.end(); cache->inst.inc(), ++j)
+			out[j] = result.get(cache->inst);
+	}
+	catch (gum::Exception& e) {
+		UE_LOG(LogTemp, Warning, TEXT("%hs from %hs"), e.errorType().c_str(), e.errorContent().c_str());
+		return false;
+	}
+	return true;
+}
+
+double UBayesianNetworkSession::getEntropy(const FBNNodeHandle& node)
+{
+	if (!refreshInference() || !model->findNodeCache(node))
+		return 0;
+
+	try {
+		return inference->H(node.id);
+	}
+	catch (gum::Exception& e) {
+		UE_LOG(LogTemp, Warning, TEXT("%hs from %hs"), e.errorType().c_str(), e.errorContent().c_str());
+	}
+	return 0;
+}
+
+TMap<FString, float> UBayesianNetworkSession::getPosterior(FString variable)
+{
+	TMap<FString, float> out;
+
+	if (!model)
+		return out;
+
+	const FBNNodeHandle node = model->getNodeHandle(variable);
+	TArray<float, TInlineAllocator<32>> values;
+
+	values.SetNumUninitialized(node.domainSize);
+	if (!node.IsValid() || !getPosterior(node, values))
+		return out;
+
+	const TArray<FString>& labels = model->getLabels(node);
+
+	for (int32 j = 0; j < labels.Num(); j++)
+		out.Add(labels[j], values[j]);
+
+	return out;
+}
+
+void UBayesianNetworkSession::addEvidence(FString variable, TArray<float> data)
+{
+	if (model)
+		addEvidence(model->getNodeHandle(variable), TArrayView<const float>(data));
+}
+
+void UBayesianNetworkSession::eraseEvidence(FString variable)
+{
+	if (model)
+		eraseEvidence(model->getNodeHandle(variable));
+}
+
+double UBayesianNetworkSession::getEntropy(FString variable)
+{
+	if (model)
+		return getEntropy(model->getNodeHandle(variable));
+	return 0;
+}
+
+void UBayesianNetworkSession::addEvidenceByHandle(const FBNNodeHandle& node, const TArray<float>& data)
+{
+	addEvidence(node, TArrayView<const float>(data));
+}
+
+void UBayesianNetworkSession::eraseEvidenceByHandle(const FBNNodeHandle& node)
+{
+	eraseEvidence(node);
+}
+
+bool UBayesianNetworkSession::getPosteriorByHandle(const FBNNodeHandle& node, TArray<float>& values)
+{
+	values.SetNumUninitialized(node.domainSize, false);
+	return getPosterior(node, TArrayView<float>(values));
+}
+
+double UBayesianNetworkSession::getEntropyByHandle(const FBNNodeHandle& node)
+{
+	return getEntropy(node);
+}
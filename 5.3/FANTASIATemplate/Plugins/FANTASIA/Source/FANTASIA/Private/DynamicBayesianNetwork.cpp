@@ -0,0 +1,308 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "DynamicBayesianNetwork.h"
+
+UDynamicBayesianNetwork::UDynamicBayesianNetwork(const FObjectInitializer& ObjectInitializer)
+: Super(ObjectInitializer)
+{
+}
+
+void UDynamicBayesianNetwork::FinishDestroy()
+{
+	filterInference.reset();
+	initialInference.reset();
+	Super::FinishDestroy();
+}
+
+void UDynamicBayesianNetwork::addIntraSliceArc(FString parent, FString child)
+{
+	addArc(parent + TEXT("0"), child + TEXT("0"));
+	addArc(parent + TEXT("t"), child + TEXT("t"));
+}
+
+void UDynamicBayesianNetwork::addInterSliceArc(FString parent, FString child)
+{
+	addArc(parent + TEXT("0"), child + TEXT("t"));
+}
+
+bool UDynamicBayesianNetwork::prepareFilter()
+{
+	if (filterModelVersion == modelVersion)
+		return true;
+
+	if (turn > 0)
+		UE_LOG(LogTemp, Warning, TEXT("%s: model changed, filtering restarts from the first turn"), *GetName());
+
+	filterInference.reset();
+	initialInference.reset();
+	belief = gum::Potential<double>();
+	filterBN.clear();
+	interfaceNames.Empty();
+	initialInterface.clear();
+	previousInterface.clear();
+	currentInterface.clear();
+	turn = 0;
+
+	try {
+		for (gum::NodeId id : bn.nodes()) {
+			const FString name(bn.variable(id).name().c_str());
+			const FString base = name.LeftChop(1);
+
+			if (!name.EndsWith(TEXT("0")) && !name.EndsWith(TEXT("t"))) {
+				UE_LOG(LogTemp, Warning, TEXT("%s: %s belongs to no slice, names must end with 0 or t"), *GetName(), *name);
+				return false;
+			}
+
+			const gum::NodeId other = bn.idFromName(TCHAR_TO_UTF8(*(base + (name.EndsWith(TEXT("0")) ? TEXT("t") : TEXT("0")))));
+
+			if (bn.variable(other).domainSize() != bn.variable(id).domainSize()) {
+				UE_LOG(LogTemp, Warning, TEXT("%s: %s differs between slices"), *GetName(), *base);
+				return false;
+			}
+
+			if (name.EndsWith(TEXT("t"))) {
+				filterBN.add(bn.variable(id));
+				continue;
+			}
+
+			for (gum::NodeId parent : bn.parents(id)) {
+				if (bn.variable(parent).name().back() == 't') {
+					UE_LOG(LogTemp, Warning, TEXT("%s: arc from %hs to %s goes back in time, arcs may only go from the previous to the current slice"), *GetName(), bn.variable(parent).name().c_str(), *name);
+					return false;
+				}
+			}
+
+			for (gum::NodeId child : bn.children(id)) {
+				if (FString(bn.variable(child).name().c_str()).EndsWith(TEXT("t"))) {
+					interfaceNames.Add(base);
+					initialInterface.push_back(id);
+					break;
+				}
+			}
+		}
+
+		for (const FString& base : interfaceNames) {
+			previousInterface.push_back(filterBN.add(bn.variable(TCHAR_TO_UTF8(*(base + TEXT("0"))))));
+			currentInterface.push_back(filterBN.idFromName(TCHAR_TO_UTF8(*(base + TEXT("t")))));
+		}
+
+		// A chain over the previous interface, each variable depending on all the ones before it
+		for (size_t i = 0; i < previousInterface.size(); i++)
+			for (size_t j = 0; j < i; j++)
+				filterBN.addArc(previousInterface[j], previousInterface[i]);
+
+		for (gum::NodeId id : bn.nodes()) {
+			const std::string& child = bn.variable(id).name();
+
+			if (child.back() != 't')
+				continue;
+
+			// Parents ending in 0 are in the previous interface, they have a child ending in t
+			for (gum::NodeId parent : bn.parents(id))
+				filterBN.addArc(bn.variable(parent).name(), child);
+		}
+
+		// Copied by variable names, the parents may not be in the same order
+		for (gum::NodeId id : bn.nodes())
+			if (bn.variable(id).name().back() == 't')
+				filterBN.cpt(bn.variable(id).name()).fillWith(bn.cpt(id));
+
+		for (gum::NodeId id : previousInterface)
+			belief.add(filterBN.variable(id));
+	}
+	catch (gum::Exception& e) {
+		UE_LOG(LogTemp, Warning, TEXT("%hs from %hs while building the transition model"), e.errorType().c_str(), e.errorContent().c_str());
+		belief = gum::Potential<double>();
+		filterBN.clear();
+		return false;
+	}
+
+	filterModelVersion = modelVersion;
+	resetTurns();
+	return true;
+}
+
+void UDynamicBayesianNetwork::resetFilterInference()
+{
+	gum::NodeSet targets;
+
+	filterInference = std::make_unique<gum::LazyPropagation<double>>(&filterBN);
+	filterInference->setNumberOfThreads(1);
+
+	for (gum::NodeId id : currentInterface)
+		targets.insert(id);
+	if (targets.size() > 1)
+		filterInference->addJointTarget(targets);
+}
+
+void UDynamicBayesianNetwork::resetTurns()
+{
+	if (filterModelVersion != modelVersion) {
+		prepareFilter();
+		return;
+	}
+
+	gum::NodeSet targets;
+
+	initialInference = std::make_unique<gum::LazyPropagation<double>>(&bn);
+	initialInference->setNumberOfThreads(1);
+
+	for (gum::NodeId id : initialInterface)
+		targets.insert(id);
+	if (targets.size() > 1)
+		initialInference->addJointTarget(targets);
+
+	filterInference.reset();
+	turn = 0;
+}
+
+void UDynamicBayesianNetwork::applyBelief()
+{
+	gum::Set<const gum::DiscreteVariable*> kept;
+	gum::Potential<double> condition;
+
+	// P(x1..xk) = P(x1) P(x2 | x1) ... P(xk | x1..xk-1), each factor written into the CPT of the chain
+	for (size_t i = 0; i < previousInterface.size(); i++) {
+		const gum::DiscreteVariable& variable = filterBN.variable(previousInterface[i]);
+		const gum::Potential<double>& cpt = filterBN.cpt(previousInterface[i]);
+
+		kept.insert(&variable);
+
+		const gum::Potential<double> marginal = belief.margSumIn(kept);
+		gum::Instantiation inst(cpt);
+		std::vector<double> values;
+
+		values.reserve(cpt.domainSize());
+		for (inst.setFirst(); !inst.end(); inst.inc()) {
+			const double total = i > 0 ? condition.get(inst) : 1;
+
+			// Parent configurations ruled out by the belief get a uniform row, they carry no weight anyway
+			values.push_back(total > 0 ? marginal.get(inst) / total : 1.0 / variable.domainSize());
+		}
+
+		cpt.fillWith(values);
+		condition = marginal;
+	}
+}
+
+bool UDynamicBayesianNetwork::advanceTurn()
+{
+	if (!prepareFilter())
+		return false;
+
+	gum::LazyPropagation<double>* engine = turn == 0 ? initialInference.get() : filterInference.get();
+	const std::vector<gum::NodeId>& source = turn == 0 ? initialInterface : currentInterface;
+	const gum::BayesNet<double>& sourceBN = turn == 0 ? bn : filterBN;
+
+	try {
+		if (!source.empty()) {
+			gum::NodeSet targets;
+			gum::Instantiation inst;
+			std::vector<double> values;
+
+			for (gum::NodeId id : source) {
+				targets.insert(id);
+				inst.add(sourceBN.variable(id));
+			}
+
+			engine->makeInference();
+
+			const gum::Potential<double>& joint = source.size() > 1 ? engine->jointPosterior(targets) : engine->posterior(source[0]);
+
+			// Read in interface order, which is also the variable order of belief
+			values.reserve(belief.domainSize());
+			for (inst.setFirst(); !inst.end(); inst.inc())
+				values.push_back(joint.get(inst));
+
+			belief.fillWith(values);
+			applyBelief();
+		}
+
+		// The chain CPTs changed, the engine starts over from the new belief with no evidence
+		resetFilterInference();
+	}
+	catch (gum::Exception& e) {
+		UE_LOG(LogTemp, Warning, TEXT("%hs from %hs while advancing the turn"), e.errorType().c_str(), e.errorContent().c_str());
+		return false;
+	}
+
+	++turn;
+	return true;
+}
+
+gum::LazyPropagation<double>* UDynamicBayesianNetwork::turnInference(gum::NodeId& id, const FString& variable)
+{
+	if (!prepareFilter())
+		return nullptr;
+
+	try {
+		if (turn == 0) {
+			id = bn.idFromName(TCHAR_TO_UTF8(*(variable + TEXT("0"))));
+			return initialInference.get();
+		}
+
+		id = filterBN.idFromName(TCHAR_TO_UTF8(*(variable + TEXT("t"))));
+		return filterInference.get();
+	}
+	catch (gum::NotFound& e)
+		UE_LOG(LogTemp, Warning, TEXT("%hs from %hs"), e.errorType().c_str(), e.errorContent().c_str());
+
+	return nullptr;
+}
+
+bool UDynamicBayesianNetwork::addTurnEvidence(FString variable, TArray<float> data)
+{
+	gum::NodeId id;
+	gum::LazyPropagation<double>* engine = turnInference(id, variable);
+
+	if (!engine)
+		return false;
+
+	const std::vector<double> values(data.GetData(), data.GetData() + data.Num());
+
+	try {
+		if (engine->hasEvidence(id))
+			engine->chgEvidence(id, values);
+		else
+			engine->addEvidence(id, values);
+	}
+	catch (gum::Exception& e) {
+		UE_LOG(LogTemp, Warning, TEXT("%hs from %hs while adding evidence"), e.errorType().c_str(), e.errorContent().c_str());
+		return false;
+	}
+	return true;
+}
+
+void UDynamicBayesianNetwork::eraseTurnEvidence(FString variable)
+{
+	gum::NodeId id;
+	gum::LazyPropagation<double>* engine = turnInference(id, variable);
+
+	if (engine && engine->hasEvidence(id))
+		engine->eraseEvidence(id);
+}
+
+TMap<FString, float> UDynamicBayesianNetwork::getTurnPosterior(FString variable)
+{
+	TMap<FString, float> out;
+	gum::NodeId id;
+	gum::LazyPropagation<double>* engine = turnInference(id, variable);
+
+	if (!engine)
+		return out;
+
+	try {
+		const gum::Potential<double>& result = engine->posterior(id);
+		const gum::DiscreteVariable& var = result.variable(0);
+		gum::Instantiation inst(result);
+		int32 j;
+
+		for (inst.setFirst(), j = 0; !inst.end(); inst.inc(), ++j)
+			out.Add(FString(var.label(j).c_str()), result.get(inst));
+	}
+	catch (gum::Exception& e)
+		UE_LOG(LogTemp, Warning, TEXT("%hs from %hs"), e.errorType().c_str(), e.errorContent().c_str());
+
+	return out;
+}
@@ -0,0 +1,45 @@
+#include "InferenceThreadBudget.h"
+
+std::atomic<int32> FInferenceThreadBudget::Budget = 0;
+std::atomic<int32> FInferenceThreadBudget::InUse = 0;
+
+int32 FInferenceThreadBudget::GetDefaultBudget()
+{
+	// Keep one core for the game thread and one for the rendering thread
+	return FMath::Max(FPlatformMisc::NumberOfCores() - 2, 1);
+}
+
+void FInferenceThreadBudget::SetBudget(int32 threads)
+{
+	Budget = FMath::Max(threads, 1);
+}
+
+int32 FInferenceThreadBudget::GetBudget()
+{
+	int32 budget = Budget;
+	return budget > 0 ? budget : GetDefaultBudget();
+}
+
+int32 FInferenceThreadBudget::GetInUse()
+{
+	return InUse;
+}
+
+int32 FInferenceThreadBudget::Acquire(int32 requested)
+{
+	const int32 budget = GetBudget();
+	int32 inUse = InUse;
+	int32 granted;
+
+	// The calling thread always runs, so at least one thread is granted even when the budget is exhausted
+	do {
+		granted = FMath::Clamp(budget - inUse, 1, FMath::Max(requested, 1));
+	} while (!InUse.compare_exchange_weak(inUse, inUse + granted));
+
+	return granted;
+}
+
+void FInferenceThreadBudget::Release(int32 granted)
+{
+	InUse -= granted;
+}
@@ -0,0 +1,404 @@
+#include "JunctionTreeInference.h"
+#include "agrum/tools/graphs/algorithms/triangulations/defaultTriangulation.h"
+#include "agrum/tools/graphs/algorithms/triangulations/orderedTriangulation.h"
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+	// dst[map[i]] += src[i]
+	template <typename T>
+	void marginalize(const T* src, const int32* map, int32 size, T* dst)
+	{
+		for (int32 i = 0; i < size; i++)
+			dst[map[i]] += src[i];
+	}
+
+	// dst[i] *= factor[map[i]]
+	template <typename T>
+	void multiply(T* dst, const int32* map, int32 size, const T* factor)
+	{
+		for (int32 i = 0; i < size; i++)
+			dst[i] *= factor[map[i]];
+	}
+
+	// Multiplies the entries of each state of one variable of a table by its value in factor, in runs of stride
+	template <typename T>
+	void multiplyVariable(T* dst, int32 size, int32 stride, int32 dim, const T* factor)
+	{
+		for (int32 block = 0; block < size; block += stride * dim)
+			for (int32 s = 0; s < dim; s++) {
+				T* run = dst + block + s * stride;
+				const T value = factor[s];
+
+				for (int32 k = 0; k < stride; k++)
+					run[k] *= value;
+			}
+	}
+
+	template <typename T>
+	void sumVariable(const T* src, int32 size, int32 stride, int32 dim, double* out)
+	{
+		std::fill(out, out + dim, 0.0);
+		for (int32 block = 0; block < size; block += stride * dim)
+			for (int32 s = 0; s < dim; s++) {
+				const T* run = src + block + s * stride;
+				double total = 0;
+
+				for (int32 k = 0; k < stride; k++)
+					total += run[k];
+				out[s] += total;
+			}
+	}
+
+	template <typename T>
+	double sum(const T* values, int32 size)
+	{
+		double total = 0;
+
+		for (int32 i = 0; i < size; i++)
+			total += values[i];
+		return total;
+	}
+
+	// Divides a table by its largest entry and returns the log of that entry, so that products of small numbers
+	// keep their precision in float. Fails on an all zero table
+	template <typename T, typename TSource>
+	double rescale(const TSource* src, int32 size, T* dst)
+	{
+		double largest = 0;
+
+		for (int32 i = 0; i < size; i++)
+			largest = FMath::Max(largest, (double)src[i]);
+
+		if (largest <= 0)
+			GUM_ERROR(gum::IncompatibleEvidence, "the evidence has a null probability");
+
+		for (int32 i = 0; i < size; i++)
+			dst[i] = (T)(src[i] / largest);
+		return std::log(largest);
+	}
+}
+
+template <typename TScalar>
+TJunctionTreeInference<TScalar>::TJunctionTreeInference(const gum::IBayesNet<double>* bn, const std::vector<gum::NodeId>* order)
+: gum::MarginalTargetedInference<double>(bn)
+{
+	if (order)
+		Order = *order;
+}
+
+template <typename TScalar>
+void TJunctionTreeInference<TScalar>::onModelChanged_(const gum::GraphicalModel* bn)
+{
+	gum::MarginalTargetedInference<double>::onModelChanged_(bn);
+	Compiled = false;
+}
+
+template <typename TScalar>
+void TJunctionTreeInference<TScalar>::appendMap(const std::vector<gum::NodeId>& vars, const std::vector<int32>& dims, const std::vector<gum::NodeId>& subset)
+{
+	const gum::IBayesNet<double>& bn = this->BN();
+	std::vector<int32> strides(vars.size(), 0);
+	std::vector<int32> digits(vars.size(), 0);
+	int32 size = 1;
+	int32 index = 0;
+	int32 stride = 1;
+
+	for (gum::NodeId id : subset) {
+		strides[std::find(vars.begin(), vars.end(), id) - vars.begin()] = stride;
+		stride *= (int32)bn.variable(id).domainSize();
+	}
+
+	for (int32 dim : dims)
+		size *= dim;
+
+	// Walks the table first variable fastest, keeping the subset index up to date
+	for (int32 i = 0; i < size; i++) {
+		Maps.push_back(index);
+
+		for (size_t k = 0; k < vars.size(); k++) {
+			index += strides[k];
+			if (++digits[k] < dims[k])
+				break;
+			index -= strides[k] * dims[k];
+			digits[k] = 0;
+		}
+	}
+}
+
+template <typename TScalar>
+void TJunctionTreeInference<TScalar>::compile()
+{
+	const gum::IBayesNet<double>& bn = this->BN();
+	gum::UndiGraph moralGraph = bn.moralGraph();
+	gum::NodeProperty<gum::Size> domainSizes;
+	std::unique_ptr<gum::StaticTriangulation> triangulation;
+	gum::NodeProperty<int32> cliqueIndex;
+	gum::NodeId maxId = 0;
+
+	for (gum::NodeId id : bn.nodes()) {
+		domainSizes.insert(id, bn.variable(id).domainSize());
+		maxId = FMath::Max(maxId, id + 1);
+	}
+
+	if (Order.size() == bn.size())
+		triangulation = std::make_unique<gum::OrderedTriangulation>(&moralGraph, &domainSizes, &Order);
+	else
+		triangulation = std::make_unique<gum::DefaultTriangulation>(&moralGraph, &domainSizes);
+
+	const gum::CliqueGraph& tree = triangulation->junctionTree();
+	int32 total = 0;
+
+	Cliques.clear();
+	Separators.clear();
+	Roots.clear();
+	Maps.clear();
+
+	for (gum::NodeId c : tree.nodes()) {
+		FClique& clique = Cliques.emplace_back();
+
+		for (gum::NodeId id : tree.clique(c)) {
+			clique.vars.push_back(id);
+			clique.dims.push_back((int32)bn.variable(id).domainSize());
+			clique.size *= clique.dims.back();
+		}
+		clique.offset = total;
+		total += clique.size;
+		cliqueIndex.insert(c, (int32)Cliques.size() - 1);
+	}
+
+	// Every CPT goes into the smallest clique holding its family. Products are taken in double, then each clique is
+	// rescaled before it is stored
+	std::vector<double> products(total, 1.0);
+
+	for (gum::NodeId id : bn.nodes()) {
+		const gum::Potential<double>& cpt = bn.cpt(id);
+		std::vector<gum::NodeId> family;
+		std::vector<double> table;
+		gum::Instantiation inst(cpt);
+		int32 best = -1;
+
+		for (gum::Idx k = 0; k < cpt.nbrDim(); k++)
+			family.push_back(bn.nodeId(cpt.variable(k)));
+		for (inst.setFirst(); !inst.end(); inst.inc())
+			table.push_back(cpt.get(inst));
+
+		for (int32 c = 0; c < (int32)Cliques.size(); c++) {
+			const std::vector<gum::NodeId>& vars = Cliques[c].vars;
+
+			if ((best < 0 || Cliques[c].size < Cliques[best].size)
+				&& std::all_of(family.begin(), family.end(), [&](gum::NodeId v) { return std::find(vars.begin(), vars.end(), v) != vars.end(); }))
+				best = c;
+		}
+
+		const size_t start = Maps.size();
+
+		appendMap(Cliques[best].vars, Cliques[best].dims, family);
+		multiply(products.data() + Cliques[best].offset, Maps.data() + start, Cliques[best].size, table.data());
+		Maps.resize(start);
+	}
+
+	Initial.resize(total);
+	InitialLogScale = 0;
+	for (const FClique& clique : Cliques)
+		InitialLogScale += rescale(products.data() + clique.offset, clique.size, Initial.data() + clique.offset);
+
+	// Depth first from one root per connected component; separators are recorded parent first, then reversed
+	// so that collect visits children before their parents
+	std::vector<bool> visited(Cliques.size(), false);
+	std::vector<std::pair<gum::NodeId, gum::NodeId>> stack;
+	int32 separatorTotal = 0;
+
+	for (gum::NodeId c : tree.nodes()) {
+		if (visited[cliqueIndex[c]])
+			continue;
+
+		Roots.push_back(cliqueIndex[c]);
+		visited[cliqueIndex[c]] = true;
+		stack.emplace_back(c, c);
+
+		while (!stack.empty()) {
+			const gum::NodeId current = stack.back().first;
+			const gum::NodeId from = stack.back().second;
+
+			stack.pop_back();
+
+			if (current != from) {
+				FSeparator& separator = Separators.emplace_back();
+				std::vector<gum::NodeId> vars;
+
+				for (gum::NodeId id : tree.separator(current, from))
+					vars.push_back(id);
+
+				separator.child = cliqueIndex[current];
+				separator.parent = cliqueIndex[from];
+				separator.offset = separatorTotal;
+				for (gum::NodeId id : vars)
+					separator.size *= (int32)bn.variable(id).domainSize();
+				separatorTotal += separator.size;
+
+				separator.childMap = (int32)Maps.size();
+				appendMap(Cliques[separator.child].vars, Cliques[separator.child].dims, vars);
+				separator.parentMap = (int32)Maps.size();
+				appendMap(Cliques[separator.parent].vars, Cliques[separator.parent].dims, vars);
+			}
+
+			for (gum::NodeId next : tree.neighbours(current)) {
+				if (!visited[cliqueIndex[next]]) {
+					visited[cliqueIndex[next]] = true;
+					stack.emplace_back(next, current);
+				}
+			}
+		}
+	}
+	std::reverse(Separators.begin(), Separators.end());
+
+	Homes.assign(maxId, FHome());
+	for (gum::NodeId id : bn.nodes()) {
+		FHome& home = Homes[id];
+
+		for (int32 c = 0; c < (int32)Cliques.size(); c++) {
+			const std::vector<gum::NodeId>& vars = Cliques[c].vars;
+			const auto it = std::find(vars.begin(), vars.end(), id);
+
+			if (it == vars.end() || (home.clique >= 0 && Cliques[home.clique].size <= Cliques[c].size))
+				continue;
+
+			home.clique = c;
+			home.dim = Cliques[c].dims[it - vars.begin()];
+			home.stride = 1;
+			for (auto k = vars.begin(); k != it; ++k)
+				home.stride *= Cliques[c].dims[k - vars.begin()];
+		}
+	}
+
+	int32 widestSeparator = 1;
+	int32 widestDomain = 1;
+
+	for (const FSeparator& separator : Separators)
+		widestSeparator = FMath::Max(widestSeparator, separator.size);
+	for (gum::NodeId id : bn.nodes())
+		widestDomain = FMath::Max(widestDomain, (int32)bn.variable(id).domainSize());
+
+	Values.resize(total);
+	SeparatorValues.resize(separatorTotal);
+	Scratch.resize(widestSeparator);
+	Marginal.resize(widestDomain);
+
+	Posteriors.clear();
+	Posteriors.resize(maxId);
+	for (gum::NodeId id : bn.nodes()) {
+		Posteriors[id] = std::make_unique<gum::Potential<double>>();
+		Posteriors[id]->add(bn.variable(id));
+	}
+}
+
+template <typename TScalar>
+void TJunctionTreeInference<TScalar>::updateOutdatedStructure_()
+{
+	if (!Compiled) {
+		compile();
+		Compiled = true;
+	}
+}
+
+template <typename TScalar>
+void TJunctionTreeInference<TScalar>::makeInference_()
+{
+	const gum::IBayesNet<double>& bn = this->BN();
+	std::vector<double> source;
+	std::vector<TScalar> likelihood;
+	std::vector<int32> touched;
+	double logScale = InitialLogScale;
+
+	std::copy(Initial.begin(), Initial.end(), Values.begin());
+
+	// Likelihoods are rescaled first, then every clique that received evidence, so the scales go to logScale
+	// instead of underflowing the tables
+	for (const auto& item : this->evidence()) {
+		const FHome& home = Homes[item.first];
+		gum::Instantiation inst(*item.second);
+
+		source.clear();
+		for (inst.setFirst(); !inst.end(); inst.inc())
+			source.push_back(item.second->get(inst));
+		likelihood.resize(source.size());
+		logScale += rescale(source.data(), (int32)source.size(), likelihood.data());
+
+		multiplyVariable(Values.data() + Cliques[home.clique].offset, Cliques[home.clique].size, home.stride, home.dim, likelihood.data());
+		if (std::find(touched.begin(), touched.end(), home.clique) == touched.end())
+			touched.push_back(home.clique);
+	}
+	for (int32 c : touched) {
+		TScalar* table = Values.data() + Cliques[c].offset;
+
+		logScale += rescale(table, Cliques[c].size, table);
+	}
+
+	// Collect: separators start at one, so the parent simply absorbs the rescaled child marginal
+	for (const FSeparator& separator : Separators) {
+		TScalar* message = SeparatorValues.data() + separator.offset;
+
+		std::fill(message, message + separator.size, TScalar(0));
+		marginalize(Values.data() + Cliques[separator.child].offset, Maps.data() + separator.childMap, Cliques[separator.child].size, message);
+		logScale += rescale(message, separator.size, message);
+
+		multiply(Values.data() + Cliques[separator.parent].offset, Maps.data() + separator.parentMap, Cliques[separator.parent].size, message);
+	}
+
+	EvidenceProbability = std::exp(logScale);
+	for (int32 root : Roots) {
+		const double total = sum(Values.data() + Cliques[root].offset, Cliques[root].size);
+
+		if (total <= 0)
+			GUM_ERROR(gum::IncompatibleEvidence, "the evidence has a null probability");
+		EvidenceProbability *= total;
+	}
+
+	// Distribute: the child absorbs the ratio of the new parent marginal to what it sent
+	for (auto it = Separators.rbegin(); it != Separators.rend(); ++it) {
+		const FSeparator& separator = *it;
+		const TScalar* previous = SeparatorValues.data() + separator.offset;
+		TScalar* ratio = Scratch.data();
+
+		std::fill(ratio, ratio + separator.size, TScalar(0));
+		marginalize(Values.data() + Cliques[separator.parent].offset, Maps.data() + separator.parentMap, Cliques[separator.parent].size, ratio);
+
+		for (int32 j = 0; j < separator.size; j++)
+			ratio[j] = previous[j] > 0 ? ratio[j] / previous[j] : TScalar(0);
+
+		multiply(Values.data() + Cliques[separator.child].offset, Maps.data() + separator.childMap, Cliques[separator.child].size, ratio);
+	}
+
+	std::vector<double> values;
+
+	for (gum::NodeId id : bn.nodes()) {
+		const FHome& home = Homes[id];
+
+		sumVariable(Values.data() + Cliques[home.clique].offset, Cliques[home.clique].size, home.stride, home.dim, Marginal.data());
+
+		const double total = sum(Marginal.data(), home.dim);
+
+		values.assign(Marginal.begin(), Marginal.begin() + home.dim);
+		for (double& value : values)
+			value /= total;
+		Posteriors[id]->fillWith(values);
+	}
+}
+
+template <typename TScalar>
+const gum::Potential<double>& TJunctionTreeInference<TScalar>::posterior_(gum::NodeId id)
+{
+	return *Posteriors[id];
+}
+
+template <typename TScalar>
+double TJunctionTreeInference<TScalar>::evidenceProbability()
+{
+	this->makeInference();
+	return EvidenceProbability;
+}
+
+template class FANTASIA_API TJunctionTreeInference<double>;
+template class FANTASIA_API TJunctionTreeInference<float>;
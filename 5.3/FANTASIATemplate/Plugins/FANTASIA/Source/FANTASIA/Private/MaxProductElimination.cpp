@@ -0,0 +1,151 @@
+#include "MaxProductElimination.h"
+#include "agrum/tools/graphs/algorithms/triangulations/defaultTriangulation.h"
+#include <cmath>
+
+namespace
+{
+	using FFactors = std::vector<gum::Potential<double>>;
+
+	// Product of the factors holding variable, which are removed; empty when there are none
+	gum::Potential<double> takeBucket(FFactors& factors, const gum::DiscreteVariable& variable)
+	{
+		gum::Potential<double> product;
+		bool empty = true;
+
+		for (size_t f = 0; f < factors.size();) {
+			if (!factors[f].contains(variable)) {
+				f++;
+				continue;
+			}
+
+			product = empty ? factors[f] : product * factors[f];
+			empty = false;
+			factors[f] = std::move(factors.back());
+			factors.pop_back();
+		}
+		return product;
+	}
+
+	// Keeps factor divided by its largest entry, or only that entry once no variable is left
+	void pushFactor(FFactors& factors, gum::Potential<double>&& factor, double& logScale)
+	{
+		const double largest = factor.max();
+
+		if (largest <= 0)
+			GUM_ERROR(gum::IncompatibleEvidence, "the evidence has a null probability");
+
+		logScale += std::log(largest);
+		if (factor.nbrDim() == 0)
+			return;
+
+		factor.scale(1 / largest);
+		factors.push_back(std::move(factor));
+	}
+}
+
+void FMaxProductElimination::solve(const gum::IBayesNet<double>& bn, const gum::NodeProperty<const gum::Potential<double>*>& evidence, const std::vector<gum::NodeId>& nodes, const std::vector<gum::NodeId>* order)
+{
+	std::vector<gum::NodeId> elimination;
+	std::vector<gum::NodeId> maxed;
+	std::vector<bool> chosen;
+	FFactors factors;
+	double logScale = 0;
+	gum::NodeId maxId = 0;
+
+	for (gum::NodeId id : bn.nodes()) {
+		maxId = FMath::Max(maxId, id + 1);
+		factors.push_back(bn.cpt(id));
+	}
+	for (const auto& item : evidence)
+		factors.push_back(*item.second);
+
+	chosen.assign(maxId, false);
+	for (gum::NodeId id : nodes)
+		chosen[id] = true;
+
+	if (order && order->size() == bn.size())
+		elimination = *order;
+	else {
+		gum::UndiGraph moralGraph = bn.moralGraph();
+		gum::NodeProperty<gum::Size> domainSizes;
+
+		for (gum::NodeId id : bn.nodes())
+			domainSizes.insert(id, bn.variable(id).domainSize());
+
+		gum::DefaultTriangulation triangulation(&moralGraph, &domainSizes);
+
+		elimination = triangulation.eliminationOrder();
+	}
+
+	// Sums must come before maxima, so the order is kept within each group
+	for (gum::NodeId id : elimination) {
+		if (chosen[id]) {
+			maxed.push_back(id);
+			continue;
+		}
+
+		const gum::DiscreteVariable& variable = bn.variable(id);
+		gum::Potential<double> bucket = takeBucket(factors, variable);
+
+		if (bucket.nbrDim() > 0)
+			pushFactor(factors, bucket.margSumOut({ &variable }), logScale);
+	}
+
+	// P(e) sums out the chosen nodes as well, on a copy
+	{
+		FFactors remaining = factors;
+
+		logEvidence = logScale;
+		for (gum::NodeId id : maxed) {
+			const gum::DiscreteVariable& variable = bn.variable(id);
+			gum::Potential<double> bucket = takeBucket(remaining, variable);
+
+			if (bucket.nbrDim() > 0)
+				pushFactor(remaining, bucket.margSumOut({ &variable }), logEvidence);
+		}
+	}
+
+	std::vector<gum::Potential<double>> buckets(maxed.size());
+
+	for (size_t i = 0; i < maxed.size(); i++) {
+		const gum::DiscreteVariable& variable = bn.variable(maxed[i]);
+
+		buckets[i] = takeBucket(factors, variable);
+		if (buckets[i].nbrDim() > 0)
+			pushFactor(factors, buckets[i].margMaxOut({ &variable }), logScale);
+	}
+	logJoint = logScale;
+
+	// Every other variable of a bucket is eliminated later, so it is already decoded when walking backwards
+	std::vector<gum::Idx> decoded(maxId, 0);
+
+	for (size_t i = maxed.size(); i-- > 0;) {
+		const gum::DiscreteVariable& variable = bn.variable(maxed[i]);
+		const gum::Potential<double>& bucket = buckets[i];
+
+		if (bucket.nbrDim() == 0)
+			continue;
+
+		gum::Instantiation inst(bucket);
+		double best = -1;
+
+		for (gum::Idx k = 0; k < inst.nbrDim(); k++)
+			if (&inst.variable(k) != &variable)
+				inst.chgVal(inst.variable(k), decoded[bn.nodeId(inst.variable(k))]);
+
+		for (gum::Idx j = 0; j < variable.domainSize(); j++) {
+			inst.chgVal(variable, j);
+
+			const double value = bucket.get(inst);
+
+			if (value > best) {
+				best = value;
+				decoded[maxed[i]] = j;
+			}
+		}
+	}
+
+	states.clear();
+	for (gum::NodeId id : nodes)
+		states.push_back(decoded[id]);
+}
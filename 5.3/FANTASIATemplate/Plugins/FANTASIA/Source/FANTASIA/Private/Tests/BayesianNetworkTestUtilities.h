@@ -0,0 +1,91 @@
+#pragma once
+
+#include "BayesianNetwork.h"
+#include "Misc/AutomationTest.h"
+#include <string>
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+namespace FANTASIATests
+{
+	// Structures the engines are checked on, in fastPrototype syntax: a chain, a polytree, loops, mixed domain sizes
+	// and a grid whose cliques hold several CPTs
+	static const char* const Networks[] = {
+		"a->b->c->d->e->f",
+		"a->c;b->c;c->d;c->e;e->f;b->g",
+		"a->b;a->c;b->d;c->d;d->e;b->f;e->f;f->g",
+		"a[3]->b[4];a->c[3];b->d;c->d;d->e[5];c->e;e->f[3]",
+		"x1->x2->x3->x4;x1->y1;x2->y2;x3->y3;x4->y4;y1->y2->y3->y4;y1->z1;y2->z2;y3->z3;y4->z4;z1->z2->z3->z4"
+	};
+
+	// Grid where every node depends on its left, upper and upper left neighbours: cliques span a whole row, so
+	// propagation has enough work per clique to spread over threads
+	inline std::string gridStructure(int32 width, int32 height)
+	{
+		std::string structure;
+
+		for (int32 i = 0; i < height; i++) {
+			for (int32 j = 0; j < width; j++) {
+				const std::string node = "g" + std::to_string(i) + "_" + std::to_string(j);
+
+				if (j > 0)
+					structure += "g" + std::to_string(i) + "_" + std::to_string(j - 1) + "->" + node + ";";
+				if (i > 0)
+					structure += "g" + std::to_string(i - 1) + "_" + std::to_string(j) + "->" + node + ";";
+				if (i > 0 && j > 0)
+					structure += "g" + std::to_string(i - 1) + "_" + std::to_string(j - 1) + "->" + node + ";";
+			}
+		}
+		if (!structure.empty())
+			structure.pop_back();
+		return structure;
+	}
+
+	// Network with random CPTs, the same for the same seed
+	inline UBayesianNetwork* makeNetwork(const std::string& structure, unsigned int seed, InferenceAlgs algorithm, gum::Size domainSize = 2)
+	{
+		UBayesianNetwork* network = NewObject<UBayesianNetwork>(GetTransientPackage());
+
+		gum::initRandom(seed);
+		network->setBN(gum::BayesNet<double>::fastPrototype(structure, domainSize));
+		network->InferenceAlgorithm = algorithm;
+		network->Init();
+		return network;
+	}
+
+	// Posteriors of every node, in the order of nodeNames
+	inline bool readPosteriors(UBayesianNetwork* network, FBNPosteriorBuffer& out)
+	{
+		return network->getPosteriorsByName(network->nodeNames, out);
+	}
+
+	inline float maxDifference(const FBNPosteriorBuffer& expected, const FBNPosteriorBuffer& actual)
+	{
+		float difference = expected.values.Num() == actual.values.Num() ? 0 : 1;
+
+		for (int32 j = 0; j < FMath::Min(expected.values.Num(), actual.values.Num()); j++)
+			difference = FMath::Max(difference, FMath::Abs(expected.values[j] - actual.values[j]));
+		return difference;
+	}
+
+	// A likelihood per state that depends on seed
+	inline TArray<float> softLikelihood(int32 domainSize, int32 seed, float scale = 1)
+	{
+		TArray<float> likelihood;
+
+		for (int32 j = 0; j < domainSize; j++)
+			likelihood.Add(scale * (0.1f + 0.2f * ((j * 3 + seed) % 5)));
+		return likelihood;
+	}
+
+	// Same soft evidence on both networks
+	inline void addSoftEvidence(UBayesianNetwork* a, UBayesianNetwork* b, const FString& variable, int32 seed, float scale = 1)
+	{
+		const TArray<float> likelihood = softLikelihood(a->getNodeHandle(variable).domainSize, seed, scale);
+
+		a->addEvidence(variable, likelihood);
+		b->addEvidence(variable, likelihood);
+	}
+}
+
+#endif
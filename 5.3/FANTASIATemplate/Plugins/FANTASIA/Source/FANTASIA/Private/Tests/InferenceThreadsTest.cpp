@@ -0,0 +1,45 @@
+#include "BayesianNetworkTestUtilities.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FInferenceThreadsTest, "FANTASIA.Inference.Threads", EAutomationTestFlags::EditorContext | EAutomationTestFlags::EngineFilter)
+
+bool FInferenceThreadsTest::RunTest(const FString& Parameters)
+{
+	const std::string structure = FANTASIATests::gridStructure(8, 6);
+	const int32 maxThreads = FMath::Min(FPlatformMisc::NumberOfCoresIncludingHyperthreads(), 4);
+	UBayesianNetwork* single = FANTASIATests::makeNetwork(structure, 300, InferenceAlgs::Lazy_Propagation, 3);
+	UBayesianNetwork* parallel = FANTASIATests::makeNetwork(structure, 300, InferenceAlgs::Lazy_Propagation, 3);
+	FBNPosteriorBuffer expected, actual;
+
+	// The threads split the work, not the result
+	parallel->MaxInferenceThreads = maxThreads;
+	FANTASIATests::addSoftEvidence(single, parallel, TEXT("g0_0"), 1);
+	FANTASIATests::addSoftEvidence(single, parallel, TEXT("g5_7"), 2);
+	single->makeInference();
+	parallel->makeInference();
+
+	if (TestTrue(TEXT("Posteriors read"), FANTASIATests::readPosteriors(single, expected) && FANTASIATests::readPosteriors(parallel, actual)))
+		TestTrue(TEXT("Threads do not change the posteriors"), FANTASIATests::maxDifference(expected, actual) < 1e-6f);
+
+	if (maxThreads < 2) {
+		AddInfo(TEXT("A single core, no speedup to measure"));
+		return true;
+	}
+
+	const TMap<int32, float> times = parallel->benchmarkInferenceThreads(maxThreads, 10);
+
+	if (!TestEqual(TEXT("Every thread count is measured"), times.Num(), maxThreads))
+		return true;
+
+	float best = times[1];
+
+	for (int32 threads = 2; threads <= maxThreads; threads++)
+		best = FMath::Min(best, times[threads]);
+
+	// Timings depend on the machine load, they are reported rather than asserted
+	AddInfo(FString::Printf(TEXT("%.3f ms on one thread, %.3f ms at best, speedup %.2f"), times[1], best, best > 0 ? times[1] / best : 0.0f));
+	return true;
+}
+
+#endif
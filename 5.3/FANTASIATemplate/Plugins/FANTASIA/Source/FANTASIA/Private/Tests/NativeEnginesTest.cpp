@@ -0,0 +1,76 @@
+#include "BayesianNetworkTestUtilities.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+IMPLEMENT_COMPLEX_AUTOMATION_TEST(FNativeEnginesTest, "FANTASIA.Inference.NativeEngines", EAutomationTestFlags::EditorContext | EAutomationTestFlags::EngineFilter)
+
+void FNativeEnginesTest::GetTests(TArray<FString>& OutBeautifiedNames, TArray<FString>& OutTestCommands) const
+{
+	OutBeautifiedNames.Add(TEXT("NativeJunctionTree"));
+	OutTestCommands.Add(TEXT("NativeJunctionTree"));
+	OutBeautifiedNames.Add(TEXT("ArithmeticCircuit"));
+	OutTestCommands.Add(TEXT("ArithmeticCircuit"));
+}
+
+bool FNativeEnginesTest::RunTest(const FString& Parameters)
+{
+	const float tolerance = 1e-6f;
+	const bool circuit = Parameters == TEXT("ArithmeticCircuit");
+	const InferenceAlgs algorithm = circuit ? InferenceAlgs::ArithmeticCircuit : InferenceAlgs::NativeJunctionTree;
+	const int32 seed = circuit ? 700 : 100;
+
+	for (int32 i = 0; i < UE_ARRAY_COUNT(FANTASIATests::Networks); i++) {
+		const char* structure = FANTASIATests::Networks[i];
+
+		// Hard evidence on sampled scenarios, through the engine and through Lazy Propagation
+		UBayesianNetwork* network = FANTASIATests::makeNetwork(structure, seed + i, algorithm);
+		const TMap<FString, float> benchmark = circuit ? network->benchmarkArithmeticCircuit(50) : network->benchmarkNativeJunctionTree(50);
+
+		if (TestTrue(FString::Printf(TEXT("%hs: benchmark ran"), structure), benchmark.Contains(TEXT("maxError")))) {
+			TestTrue(FString::Printf(TEXT("%hs: hard evidence posteriors match Lazy Propagation"), structure), benchmark[TEXT("maxError")] < tolerance);
+			if (circuit)
+				TestTrue(FString::Printf(TEXT("%hs: circuit compiled"), structure), benchmark[TEXT("circuitNodes")] > 0);
+		}
+
+		// Soft evidence through the network API
+		UBayesianNetwork* reference = FANTASIATests::makeNetwork(structure, seed + i, InferenceAlgs::Lazy_Propagation);
+		FBNPosteriorBuffer expected, actual;
+
+		FANTASIATests::addSoftEvidence(reference, network, network->nodeNames[0], 1);
+		FANTASIATests::addSoftEvidence(reference, network, network->nodeNames.Last(), 4);
+
+		if (TestTrue(FString::Printf(TEXT("%hs: posteriors read"), structure), FANTASIATests::readPosteriors(reference, expected) && FANTASIATests::readPosteriors(network, actual)))
+			TestTrue(FString::Printf(TEXT("%hs: soft evidence posteriors match Lazy Propagation"), structure), FANTASIATests::maxDifference(expected, actual) < tolerance);
+	}
+
+	// The engines are built from the CPTs, an edit must reach them
+	UBayesianNetwork* network = FANTASIATests::makeNetwork(FANTASIATests::Networks[0], 7, algorithm);
+	const FBNNodeHandle node = network->getNodeHandle(TEXT("c"));
+	TArray<float> posterior;
+
+	network->getPosteriorByHandle(node, posterior);
+	network->fillWith(node, 0.5f);
+	if (TestTrue(TEXT("Posterior read after fillWith"), network->getPosteriorByHandle(node, posterior)))
+		TestEqual(TEXT("Posterior follows the edited CPT"), posterior[0], 0.5f, tolerance);
+
+	// Likelihoods only matter up to a factor. Eleven of them scaled to 1e-30 multiply to far below the smallest
+	// double, so the engine has to rescale them; the reference gets them unscaled
+	const std::string grid = FANTASIATests::gridStructure(4, 3);
+	UBayesianNetwork* scaled = FANTASIATests::makeNetwork(grid, 8, algorithm);
+	UBayesianNetwork* reference = FANTASIATests::makeNetwork(grid, 8, InferenceAlgs::Lazy_Propagation);
+	FBNPosteriorBuffer expected, actual;
+
+	for (int32 k = 0; k < 11; k++) {
+		const FBNNodeHandle evidence = scaled->getNodeHandle(scaled->nodeNames[k]);
+
+		scaled->addEvidenceByHandle(evidence, FANTASIATests::softLikelihood(evidence.domainSize, k, 1e-30f));
+		reference->addEvidence(scaled->nodeNames[k], FANTASIATests::softLikelihood(evidence.domainSize, k));
+	}
+
+	if (TestTrue(TEXT("Posteriors read with tiny likelihoods"), FANTASIATests::readPosteriors(reference, expected) && FANTASIATests::readPosteriors(scaled, actual)))
+		TestTrue(TEXT("Tiny likelihoods do not underflow"), FANTASIATests::maxDifference(expected, actual) < tolerance);
+
+	return true;
+}
+
+#endif
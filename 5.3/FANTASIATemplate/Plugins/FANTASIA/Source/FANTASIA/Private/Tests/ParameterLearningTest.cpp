@@ -0,0 +1,73 @@
+#include "BayesianNetworkTestUtilities.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FParameterLearningTest, "FANTASIA.Learning.Parameters", EAutomationTestFlags::EditorContext | EAutomationTestFlags::EngineFilter)
+
+// Complete sample of bn drawn in topological order, state indices by node id
+static void forwardSample(const gum::BayesNet<double>& bn, FRandomStream& random, TArray<int32>& out)
+{
+	gum::Instantiation sample;
+
+	for (gum::NodeId id : bn.nodes())
+		sample.add(bn.variable(id));
+
+	for (gum::NodeId id : bn.topologicalOrder()) {
+		const gum::Potential<double>& cpt = bn.cpt(id);
+		const gum::DiscreteVariable& var = bn.variable(id);
+		gum::Instantiation inst(cpt);
+		double u = random.FRand();
+
+		inst.setVals(sample);
+		for (gum::Idx x = 0; x < var.domainSize(); x++) {
+			inst.chgVal(var, x);
+			sample.chgVal(var, x);
+			u -= cpt.get(inst);
+			if (u < 0)
+				break;
+		}
+	}
+
+	for (gum::NodeId id : bn.nodes())
+		out[id] = (int32)sample.val(bn.variable(id));
+}
+
+bool FParameterLearningTest::RunTest(const FString& Parameters)
+{
+	const int32 samples = 20000;
+
+	for (int32 i = 0; i < UE_ARRAY_COUNT(FANTASIATests::Networks); i++) {
+		const char* structure = FANTASIATests::Networks[i];
+		FRandomStream random(500 + i);
+		TArray<int32> sample;
+
+		// Same structure, other CPTs: the counts have to bring the learner to the generating network
+		gum::initRandom(500 + i);
+		const gum::BayesNet<double> generator = gum::BayesNet<double>::fastPrototype(structure);
+		UBayesianNetwork* expected = FANTASIATests::makeNetwork(structure, 500 + i, InferenceAlgs::Lazy_Propagation);
+		UBayesianNetwork* learner = FANTASIATests::makeNetwork(structure, 600 + i, InferenceAlgs::Lazy_Propagation);
+		FBNPosteriorBuffer reference, learned;
+
+		learner->LearningPriorStrength = 1;
+		sample.SetNum(generator.size());
+		for (int32 s = 0; s < samples; s++) {
+			forwardSample(generator, random, sample);
+			learner->recordSample(sample);
+		}
+		learner->applyLearnedParameters();
+
+		if (TestTrue(FString::Printf(TEXT("%hs: posteriors read"), structure), FANTASIATests::readPosteriors(expected, reference) && FANTASIATests::readPosteriors(learner, learned)))
+			TestTrue(FString::Printf(TEXT("%hs: learned marginals match the generating network"), structure), FANTASIATests::maxDifference(reference, learned) < 0.02f);
+
+		// The benchmark records on its own and restores the pending counts
+		learner->recordSample(sample);
+
+		const float rate = learner->benchmarkParameterLearning(10000);
+
+		TestTrue(FString::Printf(TEXT("%hs: samples are recorded (%.0f samples/s)"), structure, rate), rate > 0);
+		TestEqual(FString::Printf(TEXT("%hs: pending counts are kept"), structure), learner->getLearningSampleCount(), (int64)1);
+	}
+	return true;
+}
+
+#endif
@@ -0,0 +1,37 @@
+#include "BayesianNetworkTestUtilities.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FSinglePrecisionTest, "FANTASIA.Inference.SinglePrecision", EAutomationTestFlags::EditorContext | EAutomationTestFlags::EngineFilter)
+
+bool FSinglePrecisionTest::RunTest(const FString& Parameters)
+{
+	const float tolerance = 1e-5f;
+
+	for (int32 i = 0; i < UE_ARRAY_COUNT(FANTASIATests::Networks); i++) {
+		const char* structure = FANTASIATests::Networks[i];
+		UBayesianNetwork* single = FANTASIATests::makeNetwork(structure, 200 + i, InferenceAlgs::NativeJunctionTree);
+		const TMap<FString, float> benchmark = single->benchmarkSinglePrecision(50);
+
+		if (!TestTrue(FString::Printf(TEXT("%hs: benchmark ran"), structure), benchmark.Contains(TEXT("maxError"))))
+			continue;
+
+		TestTrue(FString::Printf(TEXT("%hs: float posteriors match double"), structure), benchmark[TEXT("maxError")] < tolerance);
+		TestTrue(FString::Printf(TEXT("%hs: float tables are smaller"), structure), benchmark[TEXT("singleBytes")] < benchmark[TEXT("doubleBytes")]);
+
+		// Likelihoods only matter up to a factor. Scaled down to 1e-30 on neighbouring nodes, which share cliques, they
+		// would underflow float tables that were not rescaled
+		UBayesianNetwork* reference = FANTASIATests::makeNetwork(structure, 200 + i, InferenceAlgs::NativeJunctionTree);
+		FBNPosteriorBuffer expected, actual;
+
+		single->setSinglePrecision(true);
+		for (int32 k = 0; k < FMath::Min(single->nodeNames.Num(), 4); k++)
+			FANTASIATests::addSoftEvidence(reference, single, single->nodeNames[k], k, 1e-30f);
+
+		if (TestTrue(FString::Printf(TEXT("%hs: posteriors read"), structure), FANTASIATests::readPosteriors(reference, expected) && FANTASIATests::readPosteriors(single, actual)))
+			TestTrue(FString::Printf(TEXT("%hs: tiny likelihoods do not underflow"), structure), FANTASIATests::maxDifference(expected, actual) < tolerance);
+	}
+	return true;
+}
+
+#endif
@@ -0,0 +1,35 @@
+#include "BayesianNetworkTestUtilities.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FTargetedInferenceTest, "FANTASIA.Inference.Targeted", EAutomationTestFlags::EditorContext | EAutomationTestFlags::EngineFilter)
+
+bool FTargetedInferenceTest::RunTest(const FString& Parameters)
+{
+	const std::string structure = FANTASIATests::gridStructure(6, 5);
+	const TArray<FString> targets = { TEXT("g0_0"), TEXT("g2_3") };
+	UBayesianNetwork* full = FANTASIATests::makeNetwork(structure, 400, InferenceAlgs::Lazy_Propagation, 3);
+	UBayesianNetwork* targeted = FANTASIATests::makeNetwork(structure, 400, InferenceAlgs::Lazy_Propagation, 3);
+	FBNPosteriorBuffer expected, actual;
+
+	// Evidence below the targets keeps part of the grid relevant, the rest is pruned as barren
+	targeted->setInferenceTargets(targets, true);
+	FANTASIATests::addSoftEvidence(full, targeted, TEXT("g3_4"), 3);
+
+	if (TestTrue(TEXT("Posteriors read"), full->getPosteriorsByName(targets, expected) && targeted->getPosteriorsByName(targets, actual)))
+		TestTrue(TEXT("Targeted posteriors match full propagation"), FANTASIATests::maxDifference(expected, actual) < 1e-6f);
+
+	// Without evidence a root target needs none of the other nodes
+	UBayesianNetwork* network = FANTASIATests::makeNetwork(structure, 400, InferenceAlgs::Lazy_Propagation, 3);
+
+	network->setInferenceTargets({ TEXT("g0_0") }, true);
+
+	const TMap<FString, float> times = network->benchmarkTargetedInference(10);
+
+	// Timings depend on the machine load, they are reported rather than asserted
+	if (TestTrue(TEXT("Benchmark ran"), times.Contains(TEXT("full")) && times.Contains(TEXT("targeted"))))
+		AddInfo(FString::Printf(TEXT("Full %.3f ms, targeted %.3f ms"), times[TEXT("full")], times[TEXT("targeted")]));
+	return true;
+}
+
+#endif
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "agrum/BN/IBayesNet.h"
+#include <vector>
+#include <random>
+
+// Sampler that stays alive between slices of anytime inference, so a Gibbs chain is burnt in once and then
+// continued instead of restarted. Likelihood weighting draws independent weighted samples. Each slice is one
+// batch: its weighted counts feed a batch-means variance estimate, which holds for correlated and weighted
+// samples alike, as long as a slice is long compared to the chain's mixing time
+class FANTASIA_API FAnytimeSampler
+{
+public:
+	// Posterior of node id is estimates[offsets[id]] to estimates[offsets[id + 1] - 1], erased ids get an empty range
+	std::vector<int32> offsets;
+	std::vector<double> estimates;
+
+	// evidence holds a likelihood per state for each observed node, zero entries rule the state out
+	void init(const gum::IBayesNet<double>& bn, const std::vector<std::pair<gum::NodeId, std::vector<double>>>& evidence, bool gibbs, int32 burnIn, uint32 seed);
+
+	// Draws at most maxSamples samples or stops after maxSeconds, then updates estimates. Returns the samples drawn,
+	// throws gum::IncompatibleEvidence when no sample is compatible with the evidence
+	int64 runSlice(int64 maxSamples, double maxSeconds);
+
+	int64 samples() const { return Samples; }
+	int32 batches() const { return Batches; }
+
+	// Half width of a 95% confidence interval on the worst estimated probability, 1 until enough batches are drawn
+	double errorBound() const;
+
+private:
+	struct FNode
+	{
+		int32 domain = 0;
+		// CPT in aGrUM layout: the node moves fastest, then its parents in CPT order
+		std::vector<double> cpt;
+		std::vector<gum::NodeId> parents;
+		std::vector<int32> parentStrides;
+		std::vector<gum::NodeId> children;
+		std::vector<double> likelihood;
+		bool fixed = false;
+	};
+
+	std::vector<FNode> Nodes;
+	std::vector<gum::NodeId> Topological;
+	std::vector<int32> State;
+	std::vector<double> Conditional;
+	std::mt19937_64 Random;
+	bool Gibbs = false;
+
+	// Per entry sums over batches of S_b, S_b^2 and S_b * W_b, where S_b is the weighted count of the batch and W_b
+	// its total weight, for the ratio estimator variance
+	std::vector<double> SliceCounts;
+	std::vector<double> Sums;
+	std::vector<double> SquaredSums;
+	std::vector<double> CrossSums;
+	double WeightSum = 0;
+	double SquaredWeightSum = 0;
+	int64 Samples = 0;
+	int32 Batches = 0;
+
+	int32 cptIndex(gum::NodeId id) const;
+	int32 draw(const std::vector<double>& weights, double total);
+	double forwardSample();
+	void gibbsSweep();
+};
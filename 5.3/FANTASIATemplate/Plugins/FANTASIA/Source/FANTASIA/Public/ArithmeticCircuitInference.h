@@ -0,0 +1,90 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "agrum/BN/IBayesNet.h"
+#include "agrum/BN/inference/tools/marginalTargetedInference.h"
+#include <vector>
+#include <memory>
+
+// Network polynomial of a Bayesian network, compiled by symbolic variable elimination into a flat circuit.
+// Nodes are stored children first, structure of arrays: leaves (constants, parameters, evidence indicators)
+// then sums and products, so that evaluation is one forward loop and differentiation one backward loop
+struct FANTASIA_API FArithmeticCircuit
+{
+	enum : uint8 { Leaf, Sum, Product };
+
+	std::vector<uint8> ops;
+	// Children of node i are children[childStart[i]] to children[childStart[i + 1] - 1]
+	std::vector<int32> childStart;
+	std::vector<int32> children;
+	std::vector<double> values;
+	std::vector<double> derivatives;
+	int32 firstInternal = 0;
+	int32 root = 0;
+
+	// Leaf of the indicator of state 0 of each node by id, the other states follow
+	std::vector<int32> indicators;
+
+	// order is an elimination order of every node, the min-fill heuristic is used without one
+	void compile(const gum::IBayesNet<double>& bn, const std::vector<gum::NodeId>* order);
+
+	// Upward pass over the indicator values, returns the probability of the evidence
+	double evaluate();
+
+	// Downward pass after evaluate: derivative of the root with respect to every node
+	void differentiate();
+
+	int32 size() const { return (int32)ops.size(); }
+	int32 edges() const { return (int32)children.size(); }
+
+private:
+
+	std::vector<double> scratch;
+
+	int32 addLeaf(double value);
+	int32 addNode(uint8 op, const std::vector<int32>& nodes);
+	int32 addSum(std::vector<int32>& nodes);
+	int32 addProduct(std::vector<int32>& nodes);
+};
+
+// Exact engine over an arithmetic circuit compiled once per model: every posterior comes from one upward and one
+// downward pass, P(x | e) being proportional to the indicator of x times the derivative of the circuit with respect
+// to it. Only marginal targets are supported and the engine runs on the calling thread. CPT values are copied into
+// the circuit when it compiles, the engine has to be recreated after they change
+class FANTASIA_API FArithmeticCircuitInference : public gum::MarginalTargetedInference<double>
+{
+public:
+
+	explicit FArithmeticCircuitInference(const gum::IBayesNet<double>* bn, const std::vector<gum::NodeId>* order = nullptr);
+
+	double evidenceProbability();
+
+	const FArithmeticCircuit& circuit() const { return Circuit; }
+
+protected:
+
+	virtual void onStateChanged_() override {}
+	virtual void onEvidenceAdded_(const gum::NodeId id, bool isHardEvidence) override {}
+	virtual void onEvidenceErased_(const gum::NodeId id, bool isHardEvidence) override {}
+	virtual void onAllEvidenceErased_(bool contains_hard_evidence) override {}
+	virtual void onEvidenceChanged_(const gum::NodeId id, bool hasChangedSoftHard) override {}
+	virtual void onModelChanged_(const gum::GraphicalModel* bn) override;
+	virtual void onMarginalTargetAdded_(const gum::NodeId id) override {}
+	virtual void onMarginalTargetErased_(const gum::NodeId id) override {}
+	virtual void onAllMarginalTargetsAdded_() override {}
+	virtual void onAllMarginalTargetsErased_() override {}
+
+	// Evidence only changes indicator values, so neither hard evidence nor potentials need a recompilation
+	virtual void updateOutdatedStructure_() override;
+	virtual void updateOutdatedPotentials_() override {}
+	virtual void makeInference_() override;
+	virtual const gum::Potential<double>& posterior_(gum::NodeId id) override;
+
+private:
+
+	FArithmeticCircuit Circuit;
+	std::vector<gum::NodeId> Order;
+	bool Compiled = false;
+	double EvidenceProbability = 0;
+	std::vector<std::unique_ptr<gum::Potential<double>>> Posteriors;
+};
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "HAL/Runnable.h"
+#include "HAL/RunnableThread.h"
+#include "HAL/ThreadSafeCounter.h"
+#include "BayesianNetwork.h"
+#include <vector>
+#include <memory>
+
+// Settings of one EM run, see UBayesianNetwork::startEMLearning
+struct FBayesianEMSettings
+{
+	FString Filename;
+	TArray<FString> MissingSymbols = { TEXT("?"), TEXT("") };
+	int32 MaxIterations = 20;
+	// Stops once the log-likelihood improves by less than this fraction of its magnitude
+	double Epsilon = 1e-4;
+	int32 ChunkRows = 4096;
+	// Smoothing pseudo-count added to every CPT entry in the M-step
+	double PriorWeight = 1;
+	int32 Threads = 1;
+};
+
+// Expectation maximisation of the CPTs of a network over a CSV log with missing values. The header names the
+// variables, cells hold labels. The log is streamed chunk by chunk on every iteration and the E-step of a chunk
+// is spread over several engines, each on its own copy of the network
+class FANTASIA_API FBayesianEMThread : public FRunnable
+{
+private:
+
+	struct FWorker
+	{
+		gum::BayesNet<double> bn;
+		std::unique_ptr<gum::LazyPropagation<double>> engine;
+		std::vector<double> counts;
+		double logLikelihood = 0;
+		int64 rejected = 0;
+	};
+
+	/** Stop this thread? Uses Thread Safe Counter */
+	FThreadSafeCounter StopTaskCounter;
+
+	/** Thread to run the worker FRunnable on */
+	FRunnableThread* Thread = nullptr;
+
+	std::atomic<bool> Running = true;
+
+	gum::BayesNet<double> Network;
+	FBayesianEMSettings Settings;
+	TFunction<void(int32, double)> OnIteration;
+	TFunction<void(bool, double)> OnFinished;
+
+	// Count tables laid out like the CPTs, shared by every worker
+	std::vector<FBNLearningNode> Layout;
+	std::vector<gum::NodeSet> Families;
+	std::vector<double> Parameters;
+	int32 ParameterCount = 0;
+
+	// Column of the log to node id (-1 when the column is not in the network) and label to state index
+	TArray<int32> ColumnNodes;
+	TArray<TMap<FString, int32>> ColumnLabels;
+
+	std::vector<std::unique_ptr<FWorker>> Workers;
+	double LogLikelihood = 0;
+
+	bool RunEM(FString& Error);
+	bool ReadHeader(FString& Error);
+	bool PassOverLog(FString& Error);
+	void ParseRow(const FString& Line, int32* States) const;
+	void ProcessRow(FWorker& Worker, const int32* States) const;
+	void Maximise(const std::vector<double>& Counts);
+
+public:
+
+	// onIteration and onFinished are called on this thread
+	FBayesianEMThread(const gum::BayesNet<double>& network, const FBayesianEMSettings& settings, TFunction<void(int32, double)> onIteration, TFunction<void(bool, double)> onFinished);
+
+	virtual ~FBayesianEMThread();
+
+	// Begin FRunnable interface.
+	virtual uint32 Run() override;
+	virtual void Stop() override;
+	// End FRunnable interface
+
+	bool IsRunning() const { return Running; }
+
+	/** Makes sure this thread has stopped properly */
+	void EnsureCompletion();
+
+	// Learned CPT values once the thread has finished, node after node by id in CPT order
+	const std::vector<FBNLearningNode>& GetLayout() const { return Layout; }
+	const std::vector<double>& GetParameters() const { return Parameters; }
+};
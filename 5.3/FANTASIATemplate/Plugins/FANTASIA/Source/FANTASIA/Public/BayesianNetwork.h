@@ -12,6 +12,8 @@
 #include "Runtime\Core\Public\Misc\Paths.h"
 #include "Runtime\Core\Public\Misc\FileHelper.h"
 #include <Runtime/Core/Public/Async/Async.h>
+#include "UObject/ObjectSaveContext.h"
+#include "Tickable.h"
 
 #include "agrum/BN/BayesNet.h"
 #include "agrum/BN/io/BIF/BIFWriter.h"
@@ -19,9 +21,20 @@
 #include "agrum/BN/inference/lazyPropagation.h"
 #include "agrum/BN/inference/ShaferShenoyInference.h"
 #include "agrum/BN/inference/variableElimination.h"
+#include "agrum/BN/inference/GibbsSampling.h"
+#include "agrum/BN/inference/loopyBeliefPropagation.h"
+#include "agrum/BN/inference/importanceSampling.h"
+#include "agrum/BN/inference/weightedSampling.h"
+#include "agrum/BN/inference/MonteCarloSampling.h"
+#include "agrum/BN/inference/loopySamplingInference.h"
 #include <agrum/BN/algorithms/MarkovBlanket.h>
+#include <agrum/tools/graphs/algorithms/triangulations/orderedTriangulation.h>
 
 #include "MathUtilities.h"
+#include "AnytimeSampler.h"
+#include <vector>
+#include <atomic>
+#include <memory>
 #include "BayesianNetwork.generated.h"
 
 USTRUCT(BlueprintType)
@@ -34,13 +47,70 @@ struct FMapContainer
 };
 
 DECLARE_DYNAMIC_DELEGATE_OneParam(FGetPosteriorDelegate, FMapContainer, outMap);
+DECLARE_DYNAMIC_DELEGATE_OneParam(FInferenceCompletedDelegate, bool, success);
+DECLARE_DYNAMIC_MULTICAST_DELEGATE_ThreeParams(FAnytimeInferenceEvent, float, errorBound, int64, samples, bool, finished);
+DECLARE_DYNAMIC_MULTICAST_DELEGATE_TwoParams(FEMIterationEvent, int32, iteration, float, logLikelihood);
+DECLARE_DYNAMIC_MULTICAST_DELEGATE_TwoParams(FEMFinishedEvent, bool, success, float, logLikelihood);
 
 UENUM(BlueprintType)		//"BlueprintType" is essential to include
 enum class InferenceAlgs : uint8
 {
 	Lazy_Propagation UMETA(DisplayName = "Lazy Propagation"),
 	ShaferShenoy UMETA(DisplayName = "Shafer Shenoy Inference"),
-	VariableElimination UMETA(DisplayName = "Variable Elimination")
+	VariableElimination UMETA(DisplayName = "Variable Elimination"),
+	GibbsSampling UMETA(DisplayName = "Gibbs Sampling"),
+	LoopyBeliefPropagation UMETA(DisplayName = "Loopy Belief Propagation"),
+	ImportanceSampling UMETA(DisplayName = "Importance Sampling"),
+	WeightedSampling UMETA(DisplayName = "Weighted Sampling"),
+	MonteCarloSampling UMETA(DisplayName = "Monte Carlo Sampling"),
+	LoopyGibbsSampling UMETA(DisplayName = "Loopy Gibbs Sampling"),
+	LoopyImportanceSampling UMETA(DisplayName = "Loopy Importance Sampling"),
+	LoopyWeightedSampling UMETA(DisplayName = "Loopy Weighted Sampling"),
+	LoopyMonteCarloSampling UMETA(DisplayName = "Loopy Monte Carlo Sampling"),
+	ArithmeticCircuit UMETA(DisplayName = "Arithmetic Circuit"),
+	NativeJunctionTree UMETA(DisplayName = "Native Junction Tree")
+};
+
+// How exact engines decide which potentials are relevant to a query (aGrUM RelevantPotentialsFinderType)
+UENUM(BlueprintType)
+enum class BNRelevantPotentials : uint8
+{
+	FindAll UMETA(DisplayName = "All Potentials"),
+	BayesBallNodes UMETA(DisplayName = "d-separation (Bayes Ball, nodes)"),
+	BayesBallPotentials UMETA(DisplayName = "d-separation (Bayes Ball, potentials)"),
+	KollerFriedman2009 UMETA(DisplayName = "d-separation (Koller & Friedman 2009)")
+};
+
+USTRUCT(BlueprintType)
+struct FBNJointTarget
+{
+	GENERATED_USTRUCT_BODY()
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	TArray<FString> variables;
+};
+
+USTRUCT(BlueprintType)
+struct FBNApproximationStats
+{
+	GENERATED_USTRUCT_BODY()
+
+	UPROPERTY(BlueprintReadOnly)
+	int64 iterations = 0;
+
+	UPROPERTY(BlueprintReadOnly)
+	float milliseconds = 0;
+
+	// Last epsilon measured by the stopping criterion
+	UPROPERTY(BlueprintReadOnly)
+	float epsilon = 0;
+
+	// True when stopped by epsilon or min epsilon rate rather than by an iteration or time limit
+	UPROPERTY(BlueprintReadOnly)
+	bool converged = false;
+
+	UPROPERTY(BlueprintReadOnly)
+	FString stoppingRule;
 };
 
 
@@ -56,41 +126,407 @@ struct FBayesianArcStruct
 	FString Head;
 };
 
-USTRUCT(Blueprintable)
+// A node with its labels and CPT. values run over the node first, then over parents in the order given, each
+// varying faster than the next; an empty values gives a uniform CPT
+USTRUCT(BlueprintType)
 struct FBayesianNodeStruct
 {
 	GENERATED_USTRUCT_BODY()
 
-	UPROPERTY(EditAnywhere)
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
 	FString name;
 
-	UPROPERTY(EditAnywhere)
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	FString description;
+
+	// Labels of the node
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
 	TArray<FString> variables;
 
-	UPROPERTY(EditAnywhere)
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
 	TArray<double> values;
 
-	UPROPERTY(EditAnywhere)
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
 	TArray<FString> parents;
 };
 
 
+// Elimination order computed at import time; checksum identifies the structure it was computed for. The engines
+// rebuild the junction tree from the order, which is cheap next to the search for a good one
+USTRUCT()
+struct FBayesianCompiledStructure
+{
+	GENERATED_USTRUCT_BODY()
+
+	UPROPERTY(VisibleAnywhere)
+	uint32 checksum = 0;
+
+	UPROPERTY(VisibleAnywhere)
+	TArray<int32> eliminationOrder;
+};
+
+USTRUCT(BlueprintType)
+struct FBNNodeHandle
+{
+	GENERATED_USTRUCT_BODY()
+
+	UPROPERTY(BlueprintReadOnly)
+	int32 id = INDEX_NONE;
+
+	UPROPERTY(BlueprintReadOnly)
+	int32 domainSize = 0;
+
+	// aGrUM reuses the ids of erased nodes, the generation tells a node apart from an earlier one under the same id
+	UPROPERTY(BlueprintReadOnly)
+	int32 generation = 0;
+
+	bool IsValid() const { return id != INDEX_NONE; }
+};
+
+// Posteriors of several nodes packed in one buffer: node i owns values[offsets[i]] .. values[offsets[i + 1] - 1]
+USTRUCT(BlueprintType)
+struct FBNPosteriorBuffer
+{
+	GENERATED_USTRUCT_BODY()
+
+	UPROPERTY(BlueprintReadOnly)
+	TArray<float> values;
+
+	UPROPERTY(BlueprintReadOnly)
+	TArray<int32> offsets;
+
+	int32 Num() const { return FMath::Max(offsets.Num() - 1, 0); }
+	TArrayView<const float> get(int32 i) const { return TArrayView<const float>(values.GetData() + offsets[i], offsets[i + 1] - offsets[i]); }
+};
+
+// Per-node data resolved once from the gum::BayesNet so that handle based queries do not touch strings
+struct FBNNodeCache
+{
+	bool valid = false;
+	int32 generation = 0;
+	TArray<FString> labels;
+	gum::Instantiation inst;
+	std::vector<double> evidence;
+};
+
+USTRUCT(BlueprintType)
+struct FBNPosteriorCacheStats
+{
+	GENERATED_USTRUCT_BODY()
+
+	UPROPERTY(BlueprintReadOnly)
+	int64 hits = 0;
+
+	UPROPERTY(BlueprintReadOnly)
+	int64 misses = 0;
+
+	UPROPERTY(BlueprintReadOnly)
+	int32 entries = 0;
+
+	UPROPERTY(BlueprintReadOnly)
+	int64 bytes = 0;
+};
+
+// Posteriors memoized for one evidence configuration; nodes are filled in as they are queried. newer and older
+// link the entries by last use through their keys, which stay valid when the map reallocates
+struct FBNPosteriorCacheEntry
+{
+	TArray<double> key;
+	TArray<float> values;
+	TBitArray<> present;
+	uint32 newer = 0;
+	uint32 older = 0;
+
+	SIZE_T GetAllocatedSize() const;
+};
+
+USTRUCT(BlueprintType)
+struct FBNEvidenceItem
+{
+	GENERATED_USTRUCT_BODY()
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	FString variable;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	TArray<float> values;
+};
+
+// One scenario of makeInferenceBatch, the complete evidence it is evaluated under
+USTRUCT(BlueprintType)
+struct FBNEvidenceSet
+{
+	GENERATED_USTRUCT_BODY()
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	TArray<FBNEvidenceItem> evidence;
+};
+
+USTRUCT(BlueprintType)
+struct FBNInformationGain
+{
+	GENERATED_USTRUCT_BODY()
+
+	UPROPERTY(BlueprintReadOnly)
+	FBNNodeHandle node;
+
+	UPROPERTY(BlueprintReadOnly)
+	FString variable;
+
+	// Expected reduction of the target entropy, in bits, from observing node
+	UPROPERTY(BlueprintReadOnly)
+	float gain = 0;
+};
+
+// Symmetric matrix of pairwise mutual information, in bits, stored row major over nodes
+USTRUCT(BlueprintType)
+struct FBNMutualInformationMatrix
+{
+	GENERATED_USTRUCT_BODY()
+
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	TArray<FString> variables;
+
+	UPROPERTY(BlueprintReadOnly)
+	TArray<FBNNodeHandle> nodes;
+
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	TArray<float> values;
+
+	float get(int32 i, int32 j) const { return values[i * nodes.Num() + j]; }
+};
+
+// Count table of one node for online parameter learning, laid out like its CPT (first variable varying fastest)
+struct FBNLearningNode
+{
+	int32 offset = 0;
+	std::vector<gum::NodeId> vars;
+	std::vector<int32> strides;
+};
+
+// Inference settings read on the game thread, so workers never touch the UPROPERTYs while they are edited
+struct FBNInferenceSettings
+{
+	int32 maxThreads = 1;
+	float epsilon = 0;
+	float minEpsilonRate = 0;
+	int32 maxIterations = 1;
+	float maxMilliseconds = 0;
+};
+
+// Private model copy and engine of one batch worker; aGrUM instantiations register on the potentials they
+// iterate, so concurrent engines cannot share a single BayesNet
+struct FBNBatchWorker
+{
+	gum::BayesNet<double> bn;
+	gum::MarginalTargetedInference<double>* inference = nullptr;
+	gum::ScheduledInference* scheduler = nullptr;
+	gum::ApproximationScheme* approximation = nullptr;
+
+	~FBNBatchWorker() { delete inference; }
+};
+
+class FBayesianEMThread;
+
 UCLASS(Blueprintable, BlueprintType)
-class FANTASIA_API UBayesianNetwork : public UObject
+class FANTASIA_API UBayesianNetwork : public UObject, public FTickableGameObject
 {
 	GENERATED_UCLASS_BODY()
 
+	// Sessions run their own engine over bn and read the node cache
+	friend class UBayesianNetworkSession;
+	// The dynamic variant builds its transition model from bn
+	friend class UDynamicBayesianNetwork;
+
 private:
 
 	gum::BayesNet<double> bn;
-	gum::JointTargetedInference<double>* inference = new gum::ShaferShenoyInference<double>(&bn);
+	gum::MarginalTargetedInference<double>* inference = nullptr;
+	gum::ScheduledInference* inferenceScheduler = nullptr;
+	gum::ApproximationScheme* inferenceApproximation = nullptr;
+	FBNApproximationStats approximationStats;
 	bool initialized = false;
 
+	std::vector<FBNNodeCache> nodeCache;
+	TMap<FString, int32> nodeIndex;
+	bool nodeCacheDirty = true;
+
+	// Generation of the node under each id, 0 until the next rebuildNodeCache hands out a new one. Reset by erase
+	// and by replacing the network, so stale handles fail findNodeCache
+	std::vector<int32> nodeGenerations;
+	int32 lastNodeGeneration = 0;
+
+	void rebuildNodeCache();
+	FBNNodeCache* findNodeCache(const FBNNodeHandle& node);
+
+	// Bumped on every change to structure or CPTs
+	uint32 modelVersion = 0;
+
+	// scheduler is set for exact engines, approximation for approximate ones
+	gum::MarginalTargetedInference<double>* createInference(const gum::BayesNet<double>* net, gum::ScheduledInference** scheduler, gum::ApproximationScheme** approximation, InferenceAlgs algorithm) const;
+	gum::MarginalTargetedInference<double>* createInference(const gum::BayesNet<double>* net, gum::ScheduledInference** scheduler, gum::ApproximationScheme** approximation) const { return createInference(net, scheduler, approximation, InferenceAlgorithm); }
+
+	// Propagates with as many threads as MaxInferenceThreads and the global budget allow, or
+	// within the approximation settings for approximate engines
+	void runInference(gum::MarginalTargetedInference<double>* engine, gum::ScheduledInference* scheduler, gum::ApproximationScheme* approximation, FBNApproximationStats* stats, const FBNInferenceSettings& settings) const;
+	void runInference(gum::MarginalTargetedInference<double>* engine, gum::ScheduledInference* scheduler, gum::ApproximationScheme* approximation, FBNApproximationStats* stats) const { runInference(engine, scheduler, approximation, stats, getInferenceSettings()); }
+	static void applyApproximationSettings(gum::ApproximationScheme* approximation, const FBNInferenceSettings& settings);
+	void applyApproximationSettings(gum::ApproximationScheme* approximation) const { applyApproximationSettings(approximation, getInferenceSettings()); }
+	FBNInferenceSettings getInferenceSettings() const;
+
+	// Propagates the main engine through runInference unless its posteriors are current, so queries do not trigger
+	// a lazy propagation outside the thread budget and the approximation settings. Throws what the engine throws
+	void ensureInference();
+
+#if WITH_DEV_AUTOMATION_TESTS
+	// Runs queries with hard evidence on a quarter of the nodes, drawn by forward sampling, through reference and
+	// engine; adds <referenceName>Ms, <name>Ms and the largest posterior difference as maxError to out
+	bool compareInference(gum::MarginalTargetedInference<double>& reference, const FString& referenceName, gum::MarginalTargetedInference<double>& engine, const FString& name, int32 queries, TMap<FString, float>& out);
+#endif
+
+	// Cleared by every structural edit, since an order over erased ids could still match the node count. The engines
+	// then triangulate on their own until Init or a replaced network loads an order matching the checksum
+	std::vector<gum::NodeId> compiledOrder;
+	gum::OrderedTriangulation compiledTriangulation;
+
+	uint32 computeStructureChecksum() const;
+	void loadCompiledStructure();
+
+	bool cookNetwork();
+	// Leaves the network empty and returns false when cookedNetwork has another layout or is corrupt
+	bool loadCookedNetwork();
+
+	// Asynchronous inference: the worker runs on its own copy of the model and writes into pendingPosteriors,
+	// which is swapped with completedPosteriors on the game thread when the run succeeded
+	gum::BayesNet<double> asyncBN;
+	gum::MarginalTargetedInference<double>* asyncInference = nullptr;
+	gum::ScheduledInference* asyncScheduler = nullptr;
+	gum::ApproximationScheme* asyncApproximation = nullptr;
+	FBNApproximationStats pendingApproximationStats;
+	uint32 asyncModelVersion = 0;
+	InferenceAlgs asyncAlgorithm = InferenceAlgs::ShaferShenoy;
+	bool asyncSinglePrecision = false;
+	std::atomic<bool> asyncWorking = false;
+	bool asyncPending = false;
+	bool asyncRerun = false;
+	FBNPosteriorBuffer pendingPosteriors;
+	FBNPosteriorBuffer completedPosteriors;
+	TArray<FInferenceCompletedDelegate> asyncCallbacks;
+	TArray<FInferenceCompletedDelegate> queuedCallbacks;
+
+	void launchAsyncInference();
+	void onAsyncInferenceCompleted(bool success);
+
+	// Bumped on every change to the evidence held by the game thread engine
+	uint32 evidenceVersion = 0;
+
+	// Posterior cache, keyed by the canonical evidence configuration
+	TMap<uint32, FBNPosteriorCacheEntry> posteriorCache;
+	TArray<int32> posteriorOffsets;
+	int32 posteriorSize = 0;
+	TArray<double> evidenceKey;
+	uint32 evidenceKeyHash = 0;
+	uint32 posteriorCacheEvidenceVersion = MAX_uint32;
+	uint32 posteriorCacheModelVersion = MAX_uint32;
+	uint32 posteriorCacheNewest = 0;
+	uint32 posteriorCacheOldest = 0;
+	int64 posteriorCacheBytes = 0;
+	int64 posteriorCacheHits = 0;
+	int64 posteriorCacheMisses = 0;
+
+	// Entry of the current evidence, created when missing, or nullptr when it does not fit in PosteriorCacheMaxKB
+	FBNPosteriorCacheEntry* findPosteriorCacheEntry(bool& isNew);
+	void unlinkPosteriorCacheEntry(uint32 key, FBNPosteriorCacheEntry& entry);
+	void linkPosteriorCacheEntry(uint32 key, FBNPosteriorCacheEntry& entry);
+
+	// Anytime inference: one sampling slice per tick from a sampler kept across ticks
+	FAnytimeSampler anytimeSampler;
+	FBNPosteriorBuffer anytimePosteriors;
+	uint32 anytimeModelVersion = 0;
+	int64 anytimeSamples = 0;
+	float anytimeErrorBound = 1;
+	bool anytimeRunning = false;
+
+	void runAnytimeSlice();
+	void finishAnytimeInference();
+
+	// Declares InferenceTargets and JointTargets on engine, joint targets need an exact one
+	void applyTargets(gum::MarginalTargetedInference<double>* engine, bool exact);
+	// Recreates the main engine with the current settings, keeping its evidence. Also run after CPT values change:
+	// the native engines copy the CPTs when they compile, and nothing tells an engine that its numbers moved
+	void rebuildInference();
+	// Recompiles, rebuilds the engine and re-serializes after bn has been replaced
+	void onNetworkReplaced();
+
+	// Kept between batches and rebuilt when the model or the algorithm changes
+	std::vector<std::unique_ptr<FBNBatchWorker>> batchWorkers;
+	uint32 batchModelVersion = 0;
+	InferenceAlgs batchAlgorithm = InferenceAlgs::Lazy_Propagation;
+	bool batchSinglePrecision = false;
+
+	// Evidence calls between beginEvidenceUpdate and commitEvidenceUpdate are staged here (erase flag per node)
+	// and applied at once; values come from the node cache evidence buffers
+	int32 evidenceUpdateDepth = 0;
+	TMap<int32, bool> stagedEvidence;
+	bool stagedEraseAll = false;
+
+	bool applyEvidence(gum::NodeId id, const std::vector<double>& values);
+
+	bool solveMAP(const std::vector<gum::NodeId>& nodes, TMap<FString, FString>& states, float& probability);
+
+	// Sufficient statistics of the online learner, one block per node in learningCounts
+	std::vector<FBNLearningNode> learningNodes;
+	TArray<float> learningCounts;
+	int64 learningSamples = 0;
+	uint32 learningModelVersion = 0;
+
+	// Lays out the count tables again when the model has been edited since, dropping pending counts
+	void prepareLearning();
+
+	// Readies up to tasks workers within the thread budget; the caller releases the returned count
+	int32 acquireBatchWorkers(int32 tasks);
+
+	// Background EM job, its CPTs are only applied if the model has not been edited since it started
+	FBayesianEMThread* emThread = nullptr;
+	int32 emThreads = 0;
+	uint32 emModelVersion = 0;
+
+	void onEMLearningFinished(bool success, double logLikelihood);
+
+	// arcs by (tail, head) ids, arcIds[i] being the ids of arcs[i]; rebuilt from bn whenever it is out of step
+	// with arcs, e.g. after loading
+	TMap<TPair<gum::NodeId, gum::NodeId>, int32> arcSlots;
+	TArray<TPair<gum::NodeId, gum::NodeId>> arcIds;
+
+	void rebuildArcIndex();
+	void removeArcSlot(gum::NodeId tail, gum::NodeId head);
+
 public:
 
+	virtual void BeginDestroy() override;
+	virtual bool IsReadyForFinishDestroy() override;
+	virtual void FinishDestroy() override;
+	virtual void PostLoad() override;
+
+	// FTickableGameObject, only ticks while anytime inference is running
+	virtual void Tick(float DeltaTime) override;
+	virtual bool IsTickable() const override { return anytimeRunning; }
+	virtual bool IsTickableWhenPaused() const override { return false; }
+	virtual TStatId GetStatId() const override { RETURN_QUICK_DECLARE_CYCLE_STAT(UBayesianNetwork, STATGROUP_Tickables); }
+#if WITH_EDITOR
+	virtual void PreSave(FObjectPreSaveContext ObjectSaveContext) override;
+#endif
+
 	UPROPERTY(EditAnywhere)
 	TArray<FBayesianNodeStruct> serializedNodes;
 
+	UPROPERTY(VisibleAnywhere)
+	FBayesianCompiledStructure compiledStructure;
+
+	// Binary form of the whole network (variables, arcs and one contiguous CPT block) used to rebuild it in PostLoad
+	UPROPERTY()
+	TArray<uint8> cookedNetwork;
+
 	UPROPERTY(BlueprintReadOnly)
 	TArray<FString> nodeNames;
 
@@ -100,7 +536,19 @@ public:
 	UPROPERTY(BlueprintReadOnly)
 	TArray<FString> arcs;
 
+	// Any format accepted by readNetworkFile
 	void setBN(const FString& Filename);
+	// Replaces the whole network, e.g. with one learned from data
+	void setBN(const gum::BayesNet<double>& network);
+
+	// Parses a .bif, .uai, .net, .dsl, .xdsl or .bifxml file into result, picking the reader from the extension.
+	// Touches no UObject, so imports can run it on worker threads
+	static bool readNetworkFile(const FString& Filename, gum::BayesNet<double>& result, FString& error);
+	static bool isNetworkFileSupported(const FString& Filename);
+
+	// Triangulates the current structure and stores the elimination order in the asset
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "compileStructure"), Category = "Bayesian_Network")
+	void compileStructure();
 
 	UFUNCTION(BlueprintCallable, meta = (DisplayName = "Init"), Category = "Bayesian_Network")
 	void Init();
@@ -108,9 +556,259 @@ public:
 	UPROPERTY(BlueprintReadWrite)
 	InferenceAlgs InferenceAlgorithm = InferenceAlgs::ShaferShenoy;
 
+	// Upper bound on the threads used by one propagation, further limited by the global inference thread budget
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (ClampMin = "1"))
+	int32 MaxInferenceThreads = 1;
+
+	// Native Junction Tree clique and separator tables in float rather than double, which halves them (the clique
+	// tables are held twice, as compiled and with the current evidence) and the memory traffic of propagation. The
+	// int32 entry maps and the network's CPTs are not affected. Tables are rescaled as evidence enters them so they
+	// do not underflow; posteriors stay within about 1e-5 of the double engine. Other algorithms ignore it
+	UPROPERTY(EditAnywhere, meta = (EditCondition = "InferenceAlgorithm == InferenceAlgs::NativeJunctionTree"))
+	bool SinglePrecision = false;
+
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "setSinglePrecision", Keywords = "Inference"), Category = "Bayesian_Network")
+	void setSinglePrecision(bool singlePrecision);
+
+	// Stopping criteria of the sampling and loopy algorithms
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Approximate Inference")
+	float ApproxEpsilon = 1e-2;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Approximate Inference")
+	float ApproxMinEpsilonRate = 1e-5;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Approximate Inference")
+	int32 ApproxMaxIterations = 1000000;
+
+	// Budget of a propagation run on the game thread, about a third of a 60 Hz frame. 0 disables the time limit
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Approximate Inference")
+	float ApproxMaxMilliseconds = 5;
+
+	UFUNCTION(BlueprintCallable, BlueprintPure, meta = (DisplayName = "getApproximationStats"), Category = "Bayesian_Network")
+	FBNApproximationStats getApproximationStats() const;
+
+	// Anytime inference samples a slice per tick: Gibbs algorithms continue a single chain, the other sampling
+	// algorithms selected in InferenceAlgorithm use likelihood weighting. Editing the network stops it
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Anytime Inference")
+	int32 AnytimeIterationsPerTick = 2000;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Anytime Inference")
+	float AnytimeMillisecondsPerTick = 2;
+
+	// Gibbs sweeps discarded once when the chain starts
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Anytime Inference")
+	int32 AnytimeBurnIn = 300;
+
+	// Stops once the 95% error bound on every posterior, estimated from the spread between slices, drops below this
+	// value (or ApproxMaxIterations samples are drawn)
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Anytime Inference")
+	float AnytimeTargetError = 0.01;
+
+	// Fired after every slice with the improved estimates
+	UPROPERTY(BlueprintAssignable, Category = "Anytime Inference")
+	FAnytimeInferenceEvent OnAnytimeProgress;
+
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "startAnytimeInference", Keywords = "Inference"), Category = "Bayesian_Network")
+	bool startAnytimeInference();
+
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "stopAnytimeInference", Keywords = "Inference"), Category = "Bayesian_Network")
+	void stopAnytimeInference();
+
+	UFUNCTION(BlueprintCallable, BlueprintPure, meta = (DisplayName = "isAnytimeInferenceRunning"), Category = "Bayesian_Network")
+	bool isAnytimeInferenceRunning() const { return anytimeRunning; }
+
+	bool getAnytimePosterior(const FBNNodeHandle& node, TArrayView<float> out) const;
+
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "getAnytimePosterior (Handle)", Keywords = "Inference"), Category = "Bayesian_Network")
+	bool getAnytimePosteriorByHandle(const FBNNodeHandle& node, TArray<float>& values) const;
+
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "setInferenceThreadBudget"), Category = "Bayesian_Network")
+	static void setInferenceThreadBudget(int32 threads);
+
+	UFUNCTION(BlueprintCallable, BlueprintPure, meta = (DisplayName = "getInferenceThreadBudget"), Category = "Bayesian_Network")
+	static int32 getInferenceThreadBudget();
+
+	// Memoize posteriors per evidence configuration so that revisited configurations skip propagation
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	bool UsePosteriorCache = false;
+
+	// 0 turns caching off and frees the entries
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	int32 PosteriorCacheMaxKB = 1024;
+
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "clearPosteriorCache"), Category = "Bayesian_Network")
+	void clearPosteriorCache();
+
+	UFUNCTION(BlueprintCallable, BlueprintPure, meta = (DisplayName = "getPosteriorCacheStats"), Category = "Bayesian_Network")
+	FBNPosteriorCacheStats getPosteriorCacheStats() const;
+
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "resetPosteriorCacheStats"), Category = "Bayesian_Network")
+	void resetPosteriorCacheStats();
+
 	UFUNCTION(BlueprintCallable, meta = (DisplayName = "makeInference", Keywords = "Inference", AutoCreateRefTerm = "evidences"), Category = "Bayesian_Network")
 	void makeInference();
 
+	// Evaluates every scenario on worker threads and returns one buffer per scenario holding the posteriors
+	// of targets (all nodes when empty) in the order given; returns false if any scenario failed
+	bool makeInferenceBatch(TArrayView<const FBNEvidenceSet> scenarios, TArrayView<const FBNNodeHandle> targets, TArray<FBNPosteriorBuffer>& results);
+
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "makeInferenceBatch", Keywords = "Inference", AutoCreateRefTerm = "targets"), Category = "Bayesian_Network")
+	bool makeInferenceBatchByHandle(const TArray<FBNEvidenceSet>& scenarios, const TArray<FBNNodeHandle>& targets, TArray<FBNPosteriorBuffer>& results);
+
+	// Expected information gain on target of observing each candidate under the current evidence, best first.
+	// Candidates with hard evidence gain nothing, soft evidence is replaced by the observation. Each candidate is
+	// a task on the batch workers, its outcomes share the worker's junction tree
+	TArray<FBNInformationGain> rankByExpectedInformationGain(const FBNNodeHandle& target, TArrayView<const FBNNodeHandle> candidates);
+
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "rankByExpectedInformationGain (Handle)", Keywords = "Inference"), Category = "Bayesian_Network")
+	TArray<FBNInformationGain> rankByExpectedInformationGainByHandle(const FBNNodeHandle& target, const TArray<FBNNodeHandle>& candidates);
+
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "rankByExpectedInformationGain", Keywords = "Inference"), Category = "Bayesian_Network")
+	TArray<FBNInformationGain> rankByExpectedInformationGainByName(FString target, const TArray<FString>& candidates);
+
+	// Mutual information between every pair of nodes (all nodes when empty) given the current evidence. Each row
+	// conditions on the outcomes of one node and runs as a task on the batch workers
+	bool computeMutualInformationMatrix(TArrayView<const FBNNodeHandle> nodes, FBNMutualInformationMatrix& result);
+
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "computeMutualInformationMatrix", Keywords = "Inference", AutoCreateRefTerm = "variables"), Category = "Bayesian_Network")
+	bool computeMutualInformationMatrixByName(const TArray<FString>& variables, FBNMutualInformationMatrix& result);
+
+	// Nodes analysed by the editor action, all nodes when empty
+	UPROPERTY(EditAnywhere, Category = "Analysis")
+	TArray<FString> AnalysisNodes;
+
+	UPROPERTY(VisibleAnywhere, Transient, Category = "Analysis")
+	FBNMutualInformationMatrix MutualInformation;
+
+	// Fills MutualInformation and logs the most weakly coupled nodes, candidates for pruning
+	UFUNCTION(CallInEditor, Category = "Analysis")
+	void analyzeMutualInformation();
+
+	// When set, makeInference only computes the posteriors of InferenceTargets and JointTargets, and propagation
+	// is restricted to the part of the junction tree they depend on. Posteriors of other nodes are unavailable,
+	// including the marginals used by rankByExpectedInformationGain and computeMutualInformationMatrix
+	UPROPERTY(EditAnywhere, Category = "Targets")
+	bool TargetsOnly = false;
+
+	UPROPERTY(EditAnywhere, Category = "Targets")
+	TArray<FString> InferenceTargets;
+
+	// Sets of nodes whose joint posterior is needed (exact algorithms only), kept in one clique of the junction tree
+	UPROPERTY(EditAnywhere, Category = "Targets")
+	TArray<FBNJointTarget> JointTargets;
+
+	UPROPERTY(EditAnywhere, Category = "Targets")
+	BNRelevantPotentials RelevantPotentials = BNRelevantPotentials::BayesBallPotentials;
+
+	// Skips nodes without evidence or target below them (exact algorithms only)
+	UPROPERTY(EditAnywhere, Category = "Targets")
+	bool FindBarrenNodes = true;
+
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "setInferenceTargets", Keywords = "Inference"), Category = "Bayesian_Network")
+	void setInferenceTargets(const TArray<FString>& targets, bool targetsOnly);
+
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "addJointTarget", Keywords = "Inference"), Category = "Bayesian_Network")
+	void addJointTarget(const TArray<FString>& variables);
+
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "eraseAllJointTargets", Keywords = "Inference"), Category = "Bayesian_Network")
+	void eraseAllJointTargets();
+
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "setRelevancePruning", Keywords = "Inference"), Category = "Bayesian_Network")
+	void setRelevancePruning(BNRelevantPotentials relevantPotentials, bool findBarrenNodes);
+
+	// Joint posterior of a declared joint target (or a subset of one), the first variable varying fastest
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "getJointPosterior", Keywords = "Inference"), Category = "Bayesian_Network")
+	bool getJointPosterior(const TArray<FString>& variables, TArray<float>& values);
+
+	// Most probable state of every node given the current evidence, as one joint configuration, with its
+	// probability given the evidence
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "getMPE", Keywords = "Inference"), Category = "Bayesian_Network")
+	bool getMPE(TMap<FString, FString>& states, float& probability);
+
+	// Most probable joint configuration of variables given the current evidence, the other nodes summed out
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "getMAP", Keywords = "Inference"), Category = "Bayesian_Network")
+	bool getMAP(const TArray<FString>& variables, TMap<FString, FString>& states, float& probability);
+
+	// Stages the evidence changes that follow until the matching commitEvidenceUpdate, which applies them in one
+	// pass, changing existing evidence in place. Posteriors read in between still reflect the previous evidence
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "beginEvidenceUpdate", Keywords = "Inference"), Category = "Bayesian_Network")
+	void beginEvidenceUpdate();
+
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "commitEvidenceUpdate", Keywords = "Inference"), Category = "Bayesian_Network")
+	void commitEvidenceUpdate();
+
+	// Sets the evidence of every item in a single update, other evidence is kept
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "setEvidenceBatch", Keywords = "Inference"), Category = "Bayesian_Network")
+	bool setEvidenceBatch(const TArray<FBNEvidenceItem>& evidence);
+
+	// Weight of the current CPTs, in pseudo-samples per parent configuration, when counts are folded into them
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Learning", meta = (ClampMin = "0"))
+	float LearningPriorStrength = 10;
+
+	// Fold the counts into the CPTs automatically every this many samples, 0 to fold only on request
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Learning", meta = (ClampMin = "0"))
+	int32 LearningFoldInterval = 0;
+
+	// Counts one complete or partial sample, values are state indices by node id and -1 when unobserved.
+	// A node's table is only updated when the node and all of its parents are observed
+	void recordSample(TArrayView<const int32> values);
+
+	// Counts the current hard evidence as one sample
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "recordObservation", Keywords = "Learning"), Category = "Bayesian_Network")
+	void recordObservation();
+
+	// Replaces every CPT with the posterior mean of a Dirichlet prior centred on it, LearningPriorStrength strong,
+	// updated with the counts so far, then resets the counts. Work on an async snapshot is not interrupted
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "applyLearnedParameters", Keywords = "Learning"), Category = "Bayesian_Network")
+	void applyLearnedParameters();
+
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "resetLearning", Keywords = "Learning"), Category = "Bayesian_Network")
+	void resetLearning();
+
+	UFUNCTION(BlueprintCallable, BlueprintPure, meta = (DisplayName = "getLearningSampleCount", Keywords = "Learning"), Category = "Bayesian_Network")
+	int64 getLearningSampleCount() const { return learningSamples; }
+
+	// Re-estimates every CPT by expectation maximisation over a CSV log with missing values ("?" or empty cells),
+	// starting from the current CPTs. The header names the variables and cells hold labels. The log is read
+	// chunkRows rows at a time on a background thread, once per iteration
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "startEMLearning", Keywords = "Learning"), Category = "Bayesian_Network")
+	bool startEMLearning(FString filename, int32 maxIterations = 20, float epsilon = 0.0001, int32 chunkRows = 4096, float priorWeight = 1, int32 threads = 2);
+
+	// The CPTs are left as they were
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "cancelEMLearning", Keywords = "Learning"), Category = "Bayesian_Network")
+	void cancelEMLearning();
+
+	UFUNCTION(BlueprintCallable, BlueprintPure, meta = (DisplayName = "isEMLearningRunning", Keywords = "Learning"), Category = "Bayesian_Network")
+	bool isEMLearningRunning() const { return emThread != nullptr; }
+
+	// Natural log-likelihood of the log under the parameters each iteration started from
+	UPROPERTY(BlueprintAssignable, Category = "Learning")
+	FEMIterationEvent OnEMIteration;
+
+	// Fired once the learned CPTs have been applied, or with success false when the job failed or was cancelled
+	UPROPERTY(BlueprintAssignable, Category = "Learning")
+	FEMFinishedEvent OnEMFinished;
+
+	// Lightweight per-agent evidence and Lazy Propagation state sharing this network's structure and CPTs
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "createSession", Keywords = "Inference"), Category = "Bayesian_Network")
+	class UBayesianNetworkSession* createSession(UObject* owner);
+
+	// Runs propagation on a worker thread against a snapshot of the current evidence; calls made while
+	// a run is in flight are coalesced into a single follow-up run. onCompleted tells whether the run succeeded,
+	// a failed run leaves the previous results in place
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "makeInferenceAsync", Keywords = "Inference"), Category = "Bayesian_Network")
+	void makeInferenceAsync(FInferenceCompletedDelegate onCompleted);
+
+	UFUNCTION(BlueprintCallable, BlueprintPure, meta = (DisplayName = "isInferenceRunning"), Category = "Bayesian_Network")
+	bool isInferenceRunning() const;
+
+	// Reads the last successful asynchronous result set, never the one being computed
+	bool getCompletedPosterior(const FBNNodeHandle& node, TArrayView<float> out) const;
+	const FBNPosteriorBuffer& getCompletedPosteriors() const { return completedPosteriors; }
+
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "getCompletedPosterior (Handle)", Keywords = "Inference"), Category = "Bayesian_Network")
+	bool getCompletedPosteriorByHandle(const FBNNodeHandle& node, TArray<float>& values) const;
+
 	UFUNCTION(BlueprintCallable, meta = (DisplayName = "getPosterior", Keywords = "Inference", AutoCreateRefTerm = "evidences"), Category = "Bayesian_Network")
 	TMap<FString, float> getPosterior(FString variable);
 
@@ -138,6 +836,12 @@ public:
 	UFUNCTION(BlueprintCallable, meta = (DisplayName = "addArc"), Category = "Bayesian_Network")
 	void addArc(FString parent, FString child);
 
+	// Replaces the whole network with labelized nodes, their arcs (from parents) and CPTs in one pass, linear in the
+	// size of the model. Nothing changes if a node is duplicated, a parent is missing, the arcs form a cycle or a
+	// CPT has the wrong size
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "BuildFromDescription"), Category = "Bayesian_Network")
+	bool BuildFromDescription(const TArray<FBayesianNodeStruct>& nodes);
+
 	UFUNCTION(BlueprintCallable, meta = (DisplayName = "fillWith"), Category = "Bayesian_Network")
 	void fillWith(FString variable, float value);
 
@@ -152,4 +856,69 @@ public:
 
 	UFUNCTION(BlueprintCallable, meta = (DisplayName = "getMarkovBlanketNodes"), Category = "Bayesian_Network")
 	TArray<FString> getMarkovBlanketNodes(FString variable);
+
+	// Handle based API: resolve a node once, then query it without string conversions or allocations
+
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "getNodeHandle"), Category = "Bayesian_Network")
+	FBNNodeHandle getNodeHandle(FString variable);
+
+	bool addEvidence(const FBNNodeHandle& node, TArrayView<const float> data);
+	void eraseEvidence(const FBNNodeHandle& node);
+	bool getPosterior(const FBNNodeHandle& node, TArrayView<float> out);
+	double getEntropy(const FBNNodeHandle& node);
+	void fillWith(const FBNNodeHandle& node, float value);
+	const TArray<FString>& getLabels(const FBNNodeHandle& node);
+	bool getPosteriors(TArrayView<const FBNNodeHandle> nodes, FBNPosteriorBuffer& out);
+
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "addEvidence (Handle)"), Category = "Bayesian_Network")
+	void addEvidenceByHandle(const FBNNodeHandle& node, const TArray<float>& data);
+
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "eraseEvidence (Handle)"), Category = "Bayesian_Network")
+	void eraseEvidenceByHandle(const FBNNodeHandle& node);
+
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "getPosterior (Handle)", Keywords = "Inference"), Category = "Bayesian_Network")
+	bool getPosteriorByHandle(const FBNNodeHandle& node, TArray<float>& values);
+
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "getEntropy (Handle)"), Category = "Bayesian_Network")
+	double getEntropyByHandle(const FBNNodeHandle& node);
+
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "fillWith (Handle)"), Category = "Bayesian_Network")
+	void fillWithByHandle(const FBNNodeHandle& node, float value);
+
+	UFUNCTION(BlueprintCallable, BlueprintPure, meta = (DisplayName = "getLabels (Handle)"), Category = "Bayesian_Network")
+	TArray<FString> getLabelsByHandle(const FBNNodeHandle& node);
+
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "getAllNodeHandles"), Category = "Bayesian_Network")
+	TArray<FBNNodeHandle> getAllNodeHandles();
+
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "getPosteriors (Handle)", Keywords = "Inference"), Category = "Bayesian_Network")
+	bool getPosteriorsByHandle(const TArray<FBNNodeHandle>& nodes, FBNPosteriorBuffer& result);
+
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "getPosteriors", Keywords = "Inference"), Category = "Bayesian_Network")
+	bool getPosteriorsByName(const TArray<FString>& variables, FBNPosteriorBuffer& result);
+
+	// Measures for the automation tests, not compiled into shipping builds
+#if WITH_DEV_AUTOMATION_TESTS
+	// Average propagation time in ms with the current evidence for 1 to maxThreads threads
+	TMap<int32, float> benchmarkInferenceThreads(int32 maxThreads = 8, int32 repetitions = 10);
+
+	// Average ms of makeInference plus reading the targets, with all nodes as targets and with the configured targets
+	TMap<FString, float> benchmarkTargetedInference(int32 repetitions = 10);
+
+	// Compiles the arithmetic circuit and runs the same queries, hard evidence on a quarter of the nodes drawn by
+	// forward sampling, through it and through Lazy Propagation. Gives the compile time, the circuit size, the
+	// average ms of a query reading every posterior and the largest posterior difference
+	TMap<FString, float> benchmarkArithmeticCircuit(int32 queries = 100);
+
+	// Builds the native junction tree and runs the same queries through it and through Lazy Propagation. Gives the
+	// build time, the entries of all clique tables, the average ms of a query and the largest posterior difference
+	TMap<FString, float> benchmarkNativeJunctionTree(int32 queries = 100);
+
+	// Runs the same queries through the native junction tree in double and in single precision. Gives the table
+	// memory of both, the average ms of a query and the largest posterior difference
+	TMap<FString, float> benchmarkSinglePrecision(int32 queries = 100);
+
+	// Samples per second recorded on random complete samples; pending counts are left untouched
+	float benchmarkParameterLearning(int32 samples = 100000);
+#endif
 };
@@ -0,0 +1,79 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "BayesianNetwork.h"
+#include "CoreMinimal.h"
+#include "UObject/NoExportTypes.h"
+#include <vector>
+#include "BayesianNetworkSession.generated.h"
+
+// Per-agent view of a shared UBayesianNetwork. The session owns its evidence and a Lazy Propagation engine, whatever
+// the model's InferenceAlgorithm, which reads the structure, CPTs and compiled triangulation of the model in place and
+// only stores messages, so agents never copy the network nor its clique tables.
+UCLASS(BlueprintType)
+class FANTASIA_API UBayesianNetworkSession : public UObject
+{
+	GENERATED_UCLASS_BODY()
+
+private:
+
+	UPROPERTY()
+	UBayesianNetwork* model = nullptr;
+
+	gum::MarginalTargetedInference<double>* inference = nullptr;
+	gum::ScheduledInference* inferenceScheduler = nullptr;
+	gum::ApproximationScheme* inferenceApproximation = nullptr;
+	uint32 modelVersion = 0;
+
+	// Kept outside the engine so that it can be replayed when the model changes and the engine is rebuilt
+	std::vector<std::pair<gum::NodeId, std::vector<double>>> evidence;
+
+	bool refreshInference();
+
+public:
+
+	// The engine points into the model, which may be destroyed in the same purge, so it goes first
+	virtual void BeginDestroy() override;
+
+	void setModel(UBayesianNetwork* network);
+
+	UFUNCTION(BlueprintCallable, BlueprintPure, meta = (DisplayName = "getModel"), Category = "Bayesian_Network")
+	UBayesianNetwork* getModel() const { return model; }
+
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "makeInference", Keywords = "Inference"), Category = "Bayesian_Network")
+	void makeInference();
+
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "getPosterior", Keywords = "Inference"), Category = "Bayesian_Network")
+	TMap<FString, float> getPosterior(FString variable);
+
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "addEvidence", Keywords = "Inference"), Category = "Bayesian_Network")
+	void addEvidence(FString variable, TArray<float> data);
+
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "eraseAllEvidence", Keywords = "Inference"), Category = "Bayesian_Network")
+	void eraseAllEvidence();
+
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "eraseEvidence", Keywords = "Inference"), Category = "Bayesian_Network")
+	void eraseEvidence(FString variable);
+
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "getEntropy", Keywords = "Inference"), Category = "Bayesian_Network")
+	double getEntropy(FString variable);
+
+	// Handles come from the shared model and are valid for every session on it
+	bool addEvidence(const FBNNodeHandle& node, TArrayView<const float> data);
+	void eraseEvidence(const FBNNodeHandle& node);
+	bool getPosterior(const FBNNodeHandle& node, TArrayView<float> out);
+	double getEntropy(const FBNNodeHandle& node);
+
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "addEvidence (Handle)", Keywords = "Inference"), Category = "Bayesian_Network")
+	void addEvidenceByHandle(const FBNNodeHandle& node, const TArray<float>& data);
+
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "eraseEvidence (Handle)", Keywords = "Inference"), Category = "Bayesian_Network")
+	void eraseEvidenceByHandle(const FBNNodeHandle& node);
+
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "getPosterior (Handle)", Keywords = "Inference"), Category = "Bayesian_Network")
+	bool getPosteriorByHandle(const FBNNodeHandle& node, TArray<float>& values);
+
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "getEntropy (Handle)", Keywords = "Inference"), Category = "Bayesian_Network")
+	double getEntropyByHandle(const FBNNodeHandle& node);
+};
@@ -0,0 +1,77 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "BayesianNetwork.h"
+#include "CoreMinimal.h"
+#include <vector>
+#include <memory>
+#include "DynamicBayesianNetwork.generated.h"
+
+// Two-time-slice Bayesian network. Variables follow the aGrUM convention: "X0" is X in the previous slice and "Xt"
+// in the current one. Arcs between "t" variables are intra-slice, arcs from "0" to "t" variables inter-slice;
+// the "0" slice with its own CPTs is the state before the first turn.
+// Filtering keeps the joint belief over the interface variables (those with a child in the next slice) as a
+// single potential and never unrolls, so memory and the cost of a turn do not grow with the conversation
+UCLASS(Blueprintable, BlueprintType)
+class FANTASIA_API UDynamicBayesianNetwork : public UBayesianNetwork
+{
+	GENERATED_UCLASS_BODY()
+
+private:
+
+	// Current slice plus the previous slice's interface variables, chained so that their CPTs can hold any joint belief
+	gum::BayesNet<double> filterBN;
+	std::unique_ptr<gum::LazyPropagation<double>> filterInference;
+	// Turn 0 reads the "0" slice of bn directly
+	std::unique_ptr<gum::LazyPropagation<double>> initialInference;
+	uint32 filterModelVersion = MAX_uint32;
+	int32 turn = 0;
+
+	// Interface variables in the same order everywhere: "X0" in bn, "X0" and "Xt" in filterBN
+	TArray<FString> interfaceNames;
+	std::vector<gum::NodeId> initialInterface;
+	std::vector<gum::NodeId> previousInterface;
+	std::vector<gum::NodeId> currentInterface;
+
+	// Belief over previousInterface, first variable varying fastest
+	gum::Potential<double> belief;
+
+	bool prepareFilter();
+	void resetFilterInference();
+	void applyBelief();
+	gum::LazyPropagation<double>* turnInference(gum::NodeId& id, const FString& variable);
+
+public:
+
+	virtual void FinishDestroy() override;
+
+	// Adds parent -> child in both slices
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "addIntraSliceArc"), Category = "Bayesian_Network")
+	void addIntraSliceArc(FString parent, FString child);
+
+	// Adds parent0 -> childt
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "addInterSliceArc"), Category = "Bayesian_Network")
+	void addInterSliceArc(FString parent, FString child);
+
+	// Back to the state before the first turn, dropping the belief and the evidence of the current turn
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "resetTurns", Keywords = "Inference"), Category = "Bayesian_Network")
+	void resetTurns();
+
+	// Folds the evidence of the current turn into the belief and moves to the next slice with no evidence
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "advanceTurn", Keywords = "Inference"), Category = "Bayesian_Network")
+	bool advanceTurn();
+
+	UFUNCTION(BlueprintCallable, BlueprintPure, meta = (DisplayName = "getTurn"), Category = "Bayesian_Network")
+	int32 getTurn() const { return turn; }
+
+	// Variables are named without their slice suffix and refer to the current turn
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "addTurnEvidence", Keywords = "Inference"), Category = "Bayesian_Network")
+	bool addTurnEvidence(FString variable, TArray<float> data);
+
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "eraseTurnEvidence", Keywords = "Inference"), Category = "Bayesian_Network")
+	void eraseTurnEvidence(FString variable);
+
+	UFUNCTION(BlueprintCallable, meta = (DisplayName = "getTurnPosterior", Keywords = "Inference"), Category = "Bayesian_Network")
+	TMap<FString, float> getTurnPosterior(FString variable);
+};
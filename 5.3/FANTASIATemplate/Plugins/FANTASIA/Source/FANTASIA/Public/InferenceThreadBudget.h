@@ -0,0 +1,30 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include <atomic>
+
+// Process wide number of threads that inference engines may run at the same time, shared by every
+// network so that they do not oversubscribe the cores left over by the game and rendering threads.
+// It is advisory: every caller gets at least one thread, so InUse can exceed the budget by one per
+// concurrent caller. The batch, mutual information and EM paths size their ParallelFor tasks with it,
+// but the tasks run on the UE task graph workers, whose load from the rest of the game is not counted
+class FANTASIA_API FInferenceThreadBudget
+{
+public:
+
+	static int32 GetDefaultBudget();
+
+	static void SetBudget(int32 threads);
+	static int32 GetBudget();
+	static int32 GetInUse();
+
+	// Grants between 1 and requested threads depending on what is left, never blocks. A caller over an
+	// exhausted budget still gets one thread, since the calling thread runs the work anyway
+	static int32 Acquire(int32 requested);
+	static void Release(int32 granted);
+
+private:
+
+	static std::atomic<int32> Budget;
+	static std::atomic<int32> InUse;
+};
@@ -0,0 +1,108 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "agrum/BN/IBayesNet.h"
+#include "agrum/BN/inference/tools/marginalTargetedInference.h"
+#include <vector>
+#include <memory>
+
+// Hugin propagation over a junction tree laid out once in flat arrays. Clique and separator tables live in two
+// preallocated buffers, every table is indexed first variable fastest, and each separator keeps the maps from
+// the entries of its two cliques to its own entries, so a propagation allocates nothing and never walks an
+// Instantiation. TScalar is the precision of the tables, posteriors are always read back as double. Only marginal
+// targets are supported and the engine runs on the calling thread. The clique tables are built from the CPTs when
+// the tree compiles, the engine has to be recreated after CPT values change
+template <typename TScalar>
+class TJunctionTreeInference : public gum::MarginalTargetedInference<double>
+{
+public:
+
+	explicit TJunctionTreeInference(const gum::IBayesNet<double>* bn, const std::vector<gum::NodeId>* order = nullptr);
+
+	double evidenceProbability();
+
+	// Entries of every clique table together
+	int32 tableSize() const { return (int32)Initial.size(); }
+
+	// Memory held by the clique and separator tables and by their entry maps
+	int64 tableBytes() const { return (int64)(Initial.size() + Values.size() + SeparatorValues.size()) * sizeof(TScalar) + (int64)Maps.size() * sizeof(int32); }
+
+protected:
+
+	virtual void onStateChanged_() override {}
+	virtual void onEvidenceAdded_(const gum::NodeId id, bool isHardEvidence) override {}
+	virtual void onEvidenceErased_(const gum::NodeId id, bool isHardEvidence) override {}
+	virtual void onAllEvidenceErased_(bool contains_hard_evidence) override {}
+	virtual void onEvidenceChanged_(const gum::NodeId id, bool hasChangedSoftHard) override {}
+	virtual void onModelChanged_(const gum::GraphicalModel* bn) override;
+	virtual void onMarginalTargetAdded_(const gum::NodeId id) override {}
+	virtual void onMarginalTargetErased_(const gum::NodeId id) override {}
+	virtual void onAllMarginalTargetsAdded_() override {}
+	virtual void onAllMarginalTargetsErased_() override {}
+
+	// The tree and the CPT products are built once, evidence is entered on a copy of them at every inference
+	virtual void updateOutdatedStructure_() override;
+	virtual void updateOutdatedPotentials_() override {}
+	virtual void makeInference_() override;
+	virtual const gum::Potential<double>& posterior_(gum::NodeId id) override;
+
+private:
+
+	struct FClique
+	{
+		std::vector<gum::NodeId> vars;
+		std::vector<int32> dims;
+		int32 offset = 0;
+		int32 size = 1;
+	};
+
+	struct FSeparator
+	{
+		int32 child = 0;
+		int32 parent = 0;
+		int32 offset = 0;
+		int32 size = 1;
+		// Offsets in Maps of the child and parent entry to separator entry maps
+		int32 childMap = 0;
+		int32 parentMap = 0;
+	};
+
+	// Smallest clique holding a node, and where the node sits in its table
+	struct FHome
+	{
+		int32 clique = -1;
+		int32 stride = 1;
+		int32 dim = 1;
+	};
+
+	std::vector<FClique> Cliques;
+	// In collect order, children before their parents; distribute walks it backwards
+	std::vector<FSeparator> Separators;
+	std::vector<int32> Roots;
+	std::vector<FHome> Homes;
+	std::vector<int32> Maps;
+
+	// CPT products of every clique, each divided by its largest entry; InitialLogScale is the log of those divisors
+	std::vector<TScalar> Initial;
+	double InitialLogScale = 0;
+	std::vector<TScalar> Values;
+	std::vector<TScalar> SeparatorValues;
+	std::vector<TScalar> Scratch;
+	std::vector<double> Marginal;
+
+	std::vector<gum::NodeId> Order;
+	bool Compiled = false;
+	double EvidenceProbability = 0;
+	std::vector<std::unique_ptr<gum::Potential<double>>> Posteriors;
+
+	void compile();
+	// Map from every entry of a table over vars to the entry of a table over subset
+	void appendMap(const std::vector<gum::NodeId>& vars, const std::vector<int32>& dims, const std::vector<gum::NodeId>& subset);
+};
+
+using FJunctionTreeInference = TJunctionTreeInference<double>;
+// Half the table memory and twice the SIMD width, sums that must not lose precision are kept in double
+using FJunctionTreeInferenceF = TJunctionTreeInference<float>;
+
+extern template class FANTASIA_API TJunctionTreeInference<double>;
+extern template class FANTASIA_API TJunctionTreeInference<float>;
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "agrum/BN/IBayesNet.h"
+#include <vector>
+
+// Most probable joint configuration of some nodes given the evidence (partial MAP, or MPE with every node) by
+// variable elimination: the other nodes are summed out first, then the chosen ones are maxed out and their states
+// read back bucket by bucket in reverse. Factors are rescaled as they are produced so that long products do not
+// underflow, which is why the probabilities come back as logarithms
+struct FANTASIA_API FMaxProductElimination
+{
+	// States of the nodes passed to solve, in the same order
+	std::vector<gum::Idx> states;
+	// log P(configuration, evidence) and log P(evidence)
+	double logJoint = 0;
+	double logEvidence = 0;
+
+	// order is an elimination order of every node, the min-fill heuristic is used without one. Throws
+	// gum::IncompatibleEvidence when the evidence is impossible
+	void solve(const gum::IBayesNet<double>& bn, const gum::NodeProperty<const gum::Potential<double>*>& evidence, const std::vector<gum::NodeId>& nodes, const std::vector<gum::NodeId>* order);
+};
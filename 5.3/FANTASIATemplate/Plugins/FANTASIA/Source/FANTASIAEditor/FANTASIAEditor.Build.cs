@@ -42,7 +42,11 @@ public class FANTASIAEditor : ModuleRules
                 "Slate",
                 "SlateCore",
                 "UnrealEd",
-                "AssetTools"
+                "AssetTools",
+                "DeveloperSettings",
+                "DesktopPlatform",
+                "ToolMenus",
+                "ContentBrowser"
 			}
 			);
 
@@ -2,7 +2,43 @@
 
 #include "BayesianNetworkFactory.h"
 #include "BayesianNetwork.h"
+#include "AssetToolsModule.h"
+#include "Misc/ScopedSlowTask.h"
+#include "Async/Async.h"
+#include <atomic>
 
+#define LOCTEXT_NAMESPACE "UBayesianNetworkFactory"
+
+namespace
+{
+	// One network parsed on the thread pool. Shared with the task, so a cancelled import can drop it while the
+	// parse finishes on its own
+	struct FNetworkImportJob
+	{
+		gum::BayesNet<double> Network;
+		FString Error;
+		bool Success = false;
+		std::atomic<bool> Cancelled = false;
+		std::atomic<bool> Done = false;
+	};
+
+	using FNetworkImportJobPtr = TSharedPtr<FNetworkImportJob, ESPMode::ThreadSafe>;
+
+	// Parses started by ImportNetworks ahead of FactoryCreateFile, by full path
+	TMap<FString, FNetworkImportJobPtr> PendingImports;
+
+	FNetworkImportJobPtr StartImport(const FString& Filename)
+	{
+		FNetworkImportJobPtr Job = MakeShared<FNetworkImportJob, ESPMode::ThreadSafe>();
+
+		Async(EAsyncExecution::ThreadPool, [Job, Filename]() {
+			if (!Job->Cancelled)
+				Job->Success = UBayesianNetwork::readNetworkFile(Filename, Job->Network, Job->Error);
+			Job->Done = true;
+		});
+		return Job;
+	}
+}
 
 FText FBayesianNetworkActions::GetName() const
 {
@@ -18,6 +54,11 @@ UBayesianNetworkFactory::UBayesianNetworkFactory(const FObjectInitializer& Objec
 : Super(ObjectInitializer)
 {
 	Formats.Add(FString(TEXT("bif;")) + NSLOCTEXT("UBayesianNetworkFactory", "FormatBif", "Bayesian Network File").ToString());
+	Formats.Add(FString(TEXT("uai;")) + NSLOCTEXT("UBayesianNetworkFactory", "FormatUai", "UAI Bayesian Network").ToString());
+	Formats.Add(FString(TEXT("net;")) + NSLOCTEXT("UBayesianNetworkFactory", "FormatNet", "Hugin Network").ToString());
+	Formats.Add(FString(TEXT("dsl;")) + NSLOCTEXT("UBayesianNetworkFactory", "FormatDsl", "GeNIe DSL Network").ToString());
+	Formats.Add(FString(TEXT("xdsl;")) + NSLOCTEXT("UBayesianNetworkFactory", "FormatXdsl", "GeNIe XDSL Network").ToString());
+	Formats.Add(FString(TEXT("bifxml;")) + NSLOCTEXT("UBayesianNetworkFactory", "FormatBifxml", "BIF XML Network").ToString());
 
 	bCreateNew = false;
 	bText = false;
@@ -34,18 +75,101 @@ UObject* UBayesianNetworkFactory::FactoryCreateNew(UClass* InClass, UObject* InP
 
 bool UBayesianNetworkFactory::FactoryCanImport(const FString& Filename)
 {
-	const FString Extension = FPaths::GetExtension(Filename);
-
-	if (Extension == TEXT("bif"))
-		return true;
-	return false;
+	return UBayesianNetwork::isNetworkFileSupported(Filename);
 }
 
 UObject* UBayesianNetworkFactory::FactoryCreateFile(UClass* InClass, UObject* InParent, FName InName, EObjectFlags Flags, const FString& Filename, const TCHAR* Parms, FFeedbackContext* Warn, bool& bOutOperationCanceled)
 {
+	FNetworkImportJobPtr Job;
+
+	if (!PendingImports.RemoveAndCopyValue(FPaths::ConvertRelativePathToFull(Filename), Job))
+		Job = StartImport(Filename);
+
+	if (!Job->Done) {
+		FScopedSlowTask Task(1, FText::Format(LOCTEXT("Importing", "Importing {0}"), FText::FromString(FPaths::GetCleanFilename(Filename))));
+		Task.MakeDialogDelayed(0.5f, true);
+
+		while (!Job->Done) {
+			FPlatformProcess::Sleep(0.05f);
+			Task.TickProgress();
+
+			if (Task.ShouldCancel()) {
+				Job->Cancelled = true;
+				bOutOperationCanceled = true;
+				return nullptr;
+			}
+		}
+	}
+
+	if (!Job->Success) {
+		UE_LOG(LogTemp, Warning, TEXT("Could not import %s: %s"), *Filename, *Job->Error);
+		return nullptr;
+	}
+
 	UBayesianNetwork* bnObject = NewObject<FANTASIA_API UBayesianNetwork>(InParent, InClass, InName, Flags);
 
-	bnObject->setBN(Filename);
+	bnObject->setBN(Job->Network);
 	return bnObject;
 }
 
+void UBayesianNetworkFactory::CleanUp()
+{
+	Super::CleanUp();
+
+	// Files of a batch the import skipped, e.g. when an asset by that name was kept
+	for (const auto& Pending : PendingImports)
+		Pending.Value->Cancelled = true;
+	PendingImports.Empty();
+}
+
+void UBayesianNetworkFactory::ImportNetworks(const TArray<FString>& Files, const FString& DestinationPath)
+{
+	TArray<FString> Supported;
+	TArray<FNetworkImportJobPtr> Jobs;
+	int32 Reported = 0;
+
+	for (const FString& File : Files) {
+		if (!UBayesianNetwork::isNetworkFileSupported(File)) {
+			UE_LOG(LogTemp, Warning, TEXT("Skipping %s, not a supported network format"), *File);
+			continue;
+		}
+
+		const FNetworkImportJobPtr& Job = Jobs.Add_GetRef(StartImport(File));
+
+		Supported.Add(File);
+		PendingImports.Add(FPaths::ConvertRelativePathToFull(File), Job);
+	}
+
+	if (Jobs.Num() == 0)
+		return;
+
+	{
+		FScopedSlowTask Task(Jobs.Num(), FText::Format(LOCTEXT("Parsing", "Parsing {0} Bayesian networks"), Jobs.Num()));
+		Task.MakeDialog(true);
+
+		while (Reported < Jobs.Num()) {
+			int32 Done = 0;
+
+			for (const FNetworkImportJobPtr& Job : Jobs)
+				Done += Job->Done ? 1 : 0;
+
+			Task.EnterProgressFrame(Done - Reported);
+			Reported = Done;
+
+			if (Task.ShouldCancel()) {
+				for (const FNetworkImportJobPtr& Job : Jobs)
+					Job->Cancelled = true;
+				for (const FString& File : Supported)
+					PendingImports.Remove(FPaths::ConvertRelativePathToFull(File));
+				return;
+			}
+
+			if (Reported < Jobs.Num())
+				FPlatformProcess::Sleep(0.05f);
+		}
+	}
+
+	FAssetToolsModule::GetModule().Get().ImportAssets(Supported, DestinationPath);
+}
+
+#undef LOCTEXT_NAMESPACE
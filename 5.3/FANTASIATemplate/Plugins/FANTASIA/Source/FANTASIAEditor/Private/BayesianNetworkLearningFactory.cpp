@@ -0,0 +1,211 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#include "BayesianNetworkLearningFactory.h"
+#include "Misc/ScopedSlowTask.h"
+#include "Async/Async.h"
+#include "DesktopPlatformModule.h"
+#include "IDesktopPlatform.h"
+#include "Framework/Application/SlateApplication.h"
+
+#include "agrum/BN/learning/BNLearner.h"
+#include "agrum/tools/core/approximations/approximationSchemeListener.h"
+
+#define LOCTEXT_NAMESPACE "UBayesianNetworkLearningFactory"
+
+namespace
+{
+	// Forwards the search progress and stops the search when cancelled
+	class FLearningProgressListener : public gum::ApproximationSchemeListener
+	{
+	public:
+
+		FLearningProgressListener(gum::IApproximationSchemeConfiguration& InScheme, std::atomic<bool>& InCancelled, std::atomic<int32>& InProgress)
+		: gum::ApproximationSchemeListener(InScheme), Scheme(InScheme), Cancelled(InCancelled), Progress(InProgress)
+		{
+		}
+
+		virtual void whenProgress(const void* Src, const gum::Size Step, const double Error, const double Time) override
+		{
+			// Local searches do not know how many steps are left, so the bar only approaches its end
+			Progress = 10 + (int32)(85.0 * Step / (Step + 20.0));
+
+			// aGrUM does not expect listeners to throw, so the search is stopped through its own time limit, which
+			// it checks at its next step. LearnNetwork discards the partial network
+			if (Cancelled)
+				Scheme.setMaxTime(1e-9);
+		}
+
+		virtual void whenStop(const void* Src, const std::string& Message) override
+		{
+		}
+
+	private:
+
+		gum::IApproximationSchemeConfiguration& Scheme;
+		std::atomic<bool>& Cancelled;
+		std::atomic<int32>& Progress;
+	};
+
+	std::string ToStd(const FString& Value)
+	{
+		return std::string(TCHAR_TO_UTF8(*Value));
+	}
+}
+
+UBayesianNetworkLearningFactory::UBayesianNetworkLearningFactory(const FObjectInitializer& ObjectInitializer)
+: Super(ObjectInitializer)
+{
+	bCreateNew = true;
+	bEditorImport = false;
+	bEditAfterNew = false;
+	SupportedClass = UBayesianNetwork::StaticClass();
+}
+
+FText UBayesianNetworkLearningFactory::GetDisplayName() const
+{
+	return LOCTEXT("DisplayName", "Bayesian Network (learned from CSV)");
+}
+
+bool UBayesianNetworkLearningFactory::ConfigureProperties()
+{
+	IDesktopPlatform* DesktopPlatform = FDesktopPlatformModule::Get();
+	TArray<FString> Files;
+
+	if (!DesktopPlatform)
+		return false;
+
+	if (!DesktopPlatform->OpenFileDialog(FSlateApplication::Get().FindBestParentWindowHandleForDialogs(nullptr), LOCTEXT("ChooseDataset", "Choose an interaction log").ToString(),
+		FPaths::ProjectDir(), TEXT(""), TEXT("CSV files (*.csv)|*.csv"), EFileDialogFlags::None, Files) || Files.Num() == 0)
+		return false;
+
+	DatasetFilename = Files[0];
+	return true;
+}
+
+UObject* UBayesianNetworkLearningFactory::FactoryCreateNew(UClass* InClass, UObject* InParent, FName InName, EObjectFlags Flags, UObject* Context, FFeedbackContext* Warn)
+{
+	const UBayesianNetworkLearningSettings* Settings = GetDefault<UBayesianNetworkLearningSettings>();
+	gum::BayesNet<double> Learned;
+	std::atomic<bool> Cancelled(false);
+	std::atomic<int32> Progress(0);
+	FString Error;
+	int32 Reported = 0;
+
+	FScopedSlowTask Task(100, FText::Format(LOCTEXT("Learning", "Learning Bayesian network from {0}"), FText::FromString(FPaths::GetCleanFilename(DatasetFilename))));
+	Task.MakeDialog(true);
+
+	TFuture<bool> Result = Async(EAsyncExecution::Thread, [&]() {
+		return LearnNetwork(DatasetFilename, *Settings, Learned, Cancelled, Progress, Error);
+	});
+
+	while (!Result.WaitFor(FTimespan::FromMilliseconds(100))) {
+		const int32 Current = Progress;
+
+		Task.EnterProgressFrame(Current - Reported);
+		Reported = Current;
+
+		if (Task.ShouldCancel())
+			Cancelled = true;
+	}
+
+	if (!Result.Get()) {
+		if (!Cancelled)
+			UE_LOG(LogTemp, Warning, TEXT("Could not learn a Bayesian network from %s: %s"), *DatasetFilename, *Error);
+		return nullptr;
+	}
+
+	UBayesianNetwork* bnObject = NewObject<FANTASIA_API UBayesianNetwork>(InParent, InClass, InName, Flags);
+
+	bnObject->setBN(Learned);
+	return bnObject;
+}
+
+bool UBayesianNetworkLearningFactory::LearnNetwork(const FString& Filename, const UBayesianNetworkLearningSettings& Settings, gum::BayesNet<double>& Result, std::atomic<bool>& Cancelled, std::atomic<int32>& Progress, FString& Error)
+{
+	std::vector<std::string> Missing;
+
+	for (const FString& Symbol : Settings.MissingSymbols)
+		Missing.push_back(ToStd(Symbol));
+
+	try {
+		Progress = 0;
+		// Labelized variables only, which is what the cooked network format supports
+		gum::learning::BNLearner<double> Learner(ToStd(Filename), Missing, false);
+		Progress = 10;
+
+		if (Cancelled)
+			return false;
+
+		Learner.setNumberOfThreads(Settings.NumberOfThreads > 0 ? Settings.NumberOfThreads : FPlatformMisc::NumberOfCoresIncludingHyperthreads());
+
+		switch (Settings.Score) {
+		case BNLearningScore::BIC: Learner.useScoreBIC(); break;
+		case BNLearningScore::AIC: Learner.useScoreAIC(); break;
+		case BNLearningScore::K2: Learner.useScoreK2(); break;
+		case BNLearningScore::Log2Likelihood: Learner.useScoreLog2Likelihood(); break;
+		case BNLearningScore::BDeu:
+		default: Learner.useScoreBDeu(); break;
+		}
+
+		if (Settings.PriorWeight > 0)
+			Learner.useSmoothingPrior(Settings.PriorWeight);
+		else
+			Learner.useNoPrior();
+
+		if (Settings.MaxIndegree > 0)
+			Learner.setMaxIndegree(Settings.MaxIndegree);
+
+		for (const FBayesianArcStruct& Arc : Settings.ForbiddenArcs)
+			Learner.addForbiddenArc(ToStd(Arc.Tail), ToStd(Arc.Head));
+		for (const FBayesianArcStruct& Arc : Settings.MandatoryArcs)
+			Learner.addMandatoryArc(ToStd(Arc.Tail), ToStd(Arc.Head));
+
+		std::vector<std::vector<std::string>> Slices;
+		std::vector<gum::NodeId> Order;
+
+		for (const FBNLearningTier& Tier : Settings.Tiers) {
+			Slices.emplace_back();
+			for (const FString& Variable : Tier.variables) {
+				Slices.back().push_back(ToStd(Variable));
+				Order.push_back(Learner.idFromName(ToStd(Variable)));
+			}
+		}
+		if (!Slices.empty())
+			Learner.setSliceOrder(Slices);
+
+		switch (Settings.Algorithm) {
+		case BNStructureLearningAlgorithm::LocalSearchWithTabuList:
+			Learner.useLocalSearchWithTabuList(Settings.TabuListSize);
+			break;
+		case BNStructureLearningAlgorithm::K2:
+			for (gum::NodeId Id = 0; Id < Learner.nbCols(); Id++)
+				if (std::find(Order.begin(), Order.end(), Id) == Order.end())
+					Order.push_back(Id);
+			Learner.useK2(Order);
+			break;
+		case BNStructureLearningAlgorithm::MIIC:
+			Learner.useMIIC();
+			break;
+		case BNStructureLearningAlgorithm::GreedyHillClimbing:
+		default:
+			Learner.useGreedyHillClimbing();
+			break;
+		}
+
+		FLearningProgressListener Listener(Learner, Cancelled, Progress);
+
+		Result = Learner.learnBN();
+		if (Cancelled) {
+			Error = TEXT("cancelled");
+			return false;
+		}
+		Progress = 100;
+	}
+	catch (gum::Exception& e) {
+		Error = FString::Printf(TEXT("%hs from %hs"), e.errorType().c_str(), e.errorContent().c_str());
+		return false;
+	}
+	return true;
+}
+
+#undef LOCTEXT_NAMESPACE
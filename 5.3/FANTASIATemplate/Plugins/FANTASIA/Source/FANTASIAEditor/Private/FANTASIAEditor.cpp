@@ -1,18 +1,58 @@
 // Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
 
 #include "FANTASIAEditor.h"
+#include "BayesianNetworkFactory.h"
+#include "ToolMenus.h"
+#include "ContentBrowserModule.h"
+#include "IContentBrowserSingleton.h"
+#include "DesktopPlatformModule.h"
+#include "IDesktopPlatform.h"
+#include "Framework/Application/SlateApplication.h"
 
 #define LOCTEXT_NAMESPACE "FFANTASIAEditorModule"
 
 void FFANTASIAEditorModule::StartupModule()
 {
 	// This code will execute after your module is loaded into memory; the exact timing is specified in the .uplugin file per-module
+	UToolMenus::RegisterStartupCallback(FSimpleMulticastDelegate::FDelegate::CreateRaw(this, &FFANTASIAEditorModule::RegisterMenus));
 }
 
 void FFANTASIAEditorModule::ShutdownModule()
 {
 	// This function may be called during shutdown to clean up your module.  For modules that support dynamic reloading,
 	// we call this function before unloading the module.
+	UToolMenus::UnRegisterStartupCallback(this);
+	UToolMenus::UnregisterOwner(this);
+}
+
+void FFANTASIAEditorModule::RegisterMenus()
+{
+	FToolMenuOwnerScoped OwnerScoped(this);
+	UToolMenu* Menu = UToolMenus::Get()->ExtendMenu("ContentBrowser.AddNewContextMenu");
+	FToolMenuSection& Section = Menu->FindOrAddSection("ContentBrowserImportAsset");
+
+	Section.AddMenuEntry("ImportBayesianNetworks",
+		LOCTEXT("ImportBayesianNetworks", "Import Bayesian Networks..."),
+		LOCTEXT("ImportBayesianNetworksTooltip", "Imports several .bif, .uai, .net, .dsl, .xdsl or .bifxml networks, parsed in parallel"),
+		FSlateIcon(),
+		FUIAction(FExecuteAction::CreateRaw(this, &FFANTASIAEditorModule::ImportBayesianNetworks)));
+}
+
+void FFANTASIAEditorModule::ImportBayesianNetworks()
+{
+	IDesktopPlatform* DesktopPlatform = FDesktopPlatformModule::Get();
+	TArray<FString> Files;
+
+	if (!DesktopPlatform)
+		return;
+
+	if (!DesktopPlatform->OpenFileDialog(FSlateApplication::Get().FindBestParentWindowHandleForDialogs(nullptr), LOCTEXT("ChooseNetworks", "Choose Bayesian networks").ToString(),
+		FPaths::ProjectDir(), TEXT(""), TEXT("Bayesian networks (*.bif;*.uai;*.net;*.dsl;*.xdsl;*.bifxml)|*.bif;*.uai;*.net;*.dsl;*.xdsl;*.bifxml"), EFileDialogFlags::Multiple, Files) || Files.Num() == 0)
+		return;
+
+	const FString Path = FModuleManager::LoadModuleChecked<FContentBrowserModule>("ContentBrowser").Get().GetCurrentPath().GetInternalPathString();
+
+	UBayesianNetworkFactory::ImportNetworks(Files, Path);
 }
 
 #undef LOCTEXT_NAMESPACE
@@ -25,5 +25,11 @@ public:
 	virtual UObject* FactoryCreateNew(UClass* InClass, UObject* InParent, FName InName, EObjectFlags Flags, UObject* Context, FFeedbackContext* Warn) override;
 	virtual bool FactoryCanImport(const FString& Filename) override;
 	//virtual UObject* FactoryCreateBinary(UClass* InClass, UObject* InParent, FName InName, EObjectFlags Flags, const FString& Filename, const TCHAR* Parms, FFeedbackContext* Warn, bool& bOutOperationCanceled) ;
-	virtual UObject* FactoryCreateFile(UClass* InClass, UObject* InParent, FName InName, EObjectFlags Flags, const FString& Filename, const TCHAR* Parms, FFeedbackContext* Warn, bool& bOutOperationCanceled);
+	// Parses on a worker thread behind a cancellable progress dialog, or picks up the network parsed by ImportNetworks
+	virtual UObject* FactoryCreateFile(UClass* InClass, UObject* InParent, FName InName, EObjectFlags Flags, const FString& Filename, const TCHAR* Parms, FFeedbackContext* Warn, bool& bOutOperationCanceled) override;
+	virtual void CleanUp() override;
+
+	// Parses every file in parallel on the thread pool, then imports them into DestinationPath through the regular
+	// asset import. Cancelling skips the files not parsed yet and imports nothing
+	static void ImportNetworks(const TArray<FString>& Files, const FString& DestinationPath);
 };
@@ -0,0 +1,108 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "FANTASIAEditor.h"
+#include "Factories/Factory.h"
+#include "Engine/DeveloperSettings.h"
+#include "BayesianNetwork.h"
+#include <atomic>
+
+#include "BayesianNetworkLearningFactory.generated.h"
+
+UENUM()
+enum class BNStructureLearningAlgorithm : uint8
+{
+	GreedyHillClimbing UMETA(DisplayName = "Greedy Hill Climbing"),
+	LocalSearchWithTabuList UMETA(DisplayName = "Local Search With Tabu List"),
+	K2 UMETA(DisplayName = "K2"),
+	MIIC UMETA(DisplayName = "MIIC")
+};
+
+UENUM()
+enum class BNLearningScore : uint8
+{
+	BDeu UMETA(DisplayName = "BDeu"),
+	BIC UMETA(DisplayName = "BIC"),
+	AIC UMETA(DisplayName = "AIC"),
+	K2 UMETA(DisplayName = "K2"),
+	Log2Likelihood UMETA(DisplayName = "Log2 Likelihood")
+};
+
+// Arcs may only go from a tier to the same or a later one
+USTRUCT()
+struct FBNLearningTier
+{
+	GENERATED_USTRUCT_BODY()
+
+	UPROPERTY(EditAnywhere)
+	TArray<FString> variables;
+};
+
+// Options used when learning a Bayesian network from a CSV dataset, under Project Settings > Plugins
+UCLASS(config = Editor, defaultconfig, meta = (DisplayName = "Bayesian Network Learning"))
+class FANTASIAEDITOR_API UBayesianNetworkLearningSettings : public UDeveloperSettings
+{
+	GENERATED_BODY()
+
+public:
+
+	UPROPERTY(config, EditAnywhere, Category = "Structure")
+	BNStructureLearningAlgorithm Algorithm = BNStructureLearningAlgorithm::GreedyHillClimbing;
+
+	// Ignored by MIIC, which relies on corrected mutual information
+	UPROPERTY(config, EditAnywhere, Category = "Structure")
+	BNLearningScore Score = BNLearningScore::BDeu;
+
+	// Weight of the smoothing prior, 0 for none
+	UPROPERTY(config, EditAnywhere, Category = "Structure", meta = (ClampMin = "0"))
+	float PriorWeight = 1;
+
+	// 0 for no limit
+	UPROPERTY(config, EditAnywhere, Category = "Structure", meta = (ClampMin = "0"))
+	int32 MaxIndegree = 4;
+
+	UPROPERTY(config, EditAnywhere, Category = "Structure", meta = (ClampMin = "1"))
+	int32 TabuListSize = 100;
+
+	UPROPERTY(config, EditAnywhere, Category = "Constraints")
+	TArray<FBayesianArcStruct> ForbiddenArcs;
+
+	UPROPERTY(config, EditAnywhere, Category = "Constraints")
+	TArray<FBayesianArcStruct> MandatoryArcs;
+
+	// Also gives the variable order of K2, columns not listed follow in file order
+	UPROPERTY(config, EditAnywhere, Category = "Constraints")
+	TArray<FBNLearningTier> Tiers;
+
+	UPROPERTY(config, EditAnywhere, Category = "Data")
+	TArray<FString> MissingSymbols = { TEXT("?") };
+
+	// Threads used to compute scores, 0 for all cores
+	UPROPERTY(config, EditAnywhere, Category = "Data", meta = (ClampMin = "0"))
+	int32 NumberOfThreads = 0;
+
+	virtual FName GetCategoryName() const override { return TEXT("Plugins"); }
+};
+
+// "Bayesian Network (learned from CSV)" in the content browser: asks for a dataset and learns structure and
+// parameters on a worker thread behind a cancellable progress dialog
+UCLASS()
+class FANTASIAEDITOR_API UBayesianNetworkLearningFactory : public UFactory
+{
+	GENERATED_BODY()
+
+public:
+
+	UBayesianNetworkLearningFactory(const FObjectInitializer& ObjectInitializer);
+	virtual bool ConfigureProperties() override;
+	virtual UObject* FactoryCreateNew(UClass* InClass, UObject* InParent, FName InName, EObjectFlags Flags, UObject* Context, FFeedbackContext* Warn) override;
+	virtual FText GetDisplayName() const override;
+
+	// Set by ConfigureProperties, or directly when creating assets from scripts
+	UPROPERTY(EditAnywhere, Category = "Structure Learning")
+	FString DatasetFilename;
+
+	// Blocking; progress goes from 0 to 100 and setting cancelled stops at the next progress report
+	static bool LearnNetwork(const FString& Filename, const UBayesianNetworkLearningSettings& Settings, gum::BayesNet<double>& Result, std::atomic<bool>& Cancelled, std::atomic<int32>& Progress, FString& Error);
+};
@@ -12,4 +12,10 @@ public:
 	/** IModuleInterface implementation */
 	virtual void StartupModule() override;
 	virtual void ShutdownModule() override;
+
+private:
+
+	void RegisterMenus();
+	// Multi-file import from the content browser Add menu, parsed in parallel
+	void ImportBayesianNetworks();
 };